@@ -1,8 +1,11 @@
 #ifndef STACK_CHECK_H
 #define STACK_CHECK_H
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <format>
 #include <stdexcept>
 #include <vector>
@@ -53,50 +56,236 @@ struct stack_check;
 struct stack_overflow : public std::runtime_error {
     size_t size;
     const stack_check *info;
-    stack_overflow(size_t size, const stack_check *stack) : std::runtime_error("Stack overflow"), size(size), info(stack) {}
+    stack_overflow(size_t size, const stack_check *stack) : std::runtime_error(message()), size(size), info(stack) {}
+
+    // The message string is created once in advance, and copying it into a new exception does not allocate memory
+    // (the exception object itself is still allocated by the C++ runtime with `__cxa_allocate_exception`)
+    static const std::runtime_error &message() {
+        static const std::runtime_error msg("Stack overflow");
+        return msg;
+    }
 };
 
+/**
+ * @def STACK_CHECK_THROW
+ * Throwing runtime errors. When compiling without exception support (-fno-exceptions),
+ * the error message is printed and the program is terminated. In this case, the lack of stack space
+ * can be handled with @ref stack_check::try_check_overflow and @ref stack_check::try_check_limit.
+ */
+#ifdef __cpp_exceptions
+#define STACK_CHECK_THROW(error) throw error
+#else
+#define STACK_CHECK_THROW(error) ::trust::fatal_error(error)
+#endif
+
+[[noreturn]] inline void fatal_error(const std::exception &error) {
+    fprintf(stderr, "%s\n", error.what());
+    abort();
+}
+
 #ifndef STACK_SIZE_LIMIT
 #define STACK_SIZE_LIMIT 1024
 #endif // STACK_SIZE_LIMIT
 
+/**
+ * @def STACK_CHECK_INITIAL_EXEC
+ * If defined, the thread-local variable @ref stack_check::info uses the initial-exec TLS model.
+ * This is intended for checks compiled into shared libraries, where the default global-dynamic model
+ * calls `__tls_get_addr` on every check. The variable is then placed in the static TLS block,
+ * so a library loaded with `dlopen` must fit into the reserved surplus of static TLS
+ * (see the `glibc.rtld.optional_static_tls` tunable).
+ */
+#ifdef STACK_CHECK_INITIAL_EXEC
+#define STACK_CHECK_TLS_MODEL [[gnu::tls_model("initial-exec")]]
+#else
+#define STACK_CHECK_TLS_MODEL
+#endif
+
+/**
+ * @def STACK_CHECK_STACK_POINTER
+ * If defined, the checks compare the current stack pointer instead of the frame address.
+ * `__builtin_frame_address(0)` forces the frame pointer setup in functions that would otherwise omit it,
+ * and after inlining it points to the frame of the caller, while the stack pointer also takes into account
+ * the stack space already allocated by the current function (including with `-fomit-frame-pointer`).
+ */
+
+/**
+ * @def STACK_CHECK_HIGH_WATER_MARK
+ * If defined, the check functions also record the lowest stack address seen in the thread,
+ * and @ref stack_check::max_used returns the peak stack usage of the current thread.
+ * The inline check functions are instrumented, so the macro must be defined for all translation units of the program.
+ */
+
 typedef std::vector<void *> AddrListType;
 
 /*
- * To use, you must define the static variable `const thread_local trust::stack_check trust::stack_check::info`
+ * Counters of a call site whose check is injected by the plugin with the `counters` argument.
+ * The plugin creates one such structure for each injected check in the `stack_check_sites` section,
+ * and the runtime dumps all of them at exit (see @ref stack_check::dump_sites).
+ */
+struct stack_check_site {
+    uint64_t count;
+    uint64_t min_free;
+    const char *file;
+    const char *callee;
+    uint64_t line;
+};
+
+/*
+ * Frame size of a function annotated with `STACK_CHECK_SIZE(0)`, whose size is determined automatically.
+ * The plugin creates one such structure for each of these functions called in a translation unit,
+ * and the size is resolved from the `.stack_sizes` section on the first check (see @ref stack_check::check_overflow_frame).
+ */
+struct stack_check_frame {
+    // Until the size is resolved, it exceeds any free stack space, so the check takes the slow path that resolves it
+    static constexpr uint64_t unresolved = UINT64_MAX / 4;
+
+    const void *func;
+    uint64_t size;
+};
+
+/*
+ * The stack parameters of each thread are stored in the thread-local variable `trust::stack_check::info`.
+ * It is constant-initialized, so accessing it from the check functions does not require
+ * a dynamic initialization guard, and the stack bounds of the thread are queried
+ * on the first check performed in the thread (or explicitly by calling @ref init_thread).
  */
 struct stack_check {
     static constexpr size_t limit_for_error = STACK_SIZE_LIMIT;
-    const size_t limit;
-    void *top;
-    void *bottom;
-    void *bottom_limit;
-    void *frame;
 
-    static const thread_local stack_check info;
+    // Until the thread is initialized, the lower bound is above any stack address of a 64-bit process,
+    // so the first check in the thread always takes the slow path that initializes it.
+    static constexpr uintptr_t uninitialized = UINTPTR_MAX / 2;
+
+    // The hot state used by the check functions
+    uintptr_t bottom = uninitialized;
+    uintptr_t bottom_limit = UINTPTR_MAX;
+
+    size_t limit = 0;
+    void *top = nullptr;
+    void *frame = nullptr;
+
+    // The lowest stack address seen by the checks (updated only with STACK_CHECK_HIGH_WATER_MARK)
+    uintptr_t lowest = UINTPTR_MAX;
 
-    stack_check(const AddrListType *include = nullptr, const AddrListType *exclude = nullptr)
-        : limit(0), top(nullptr), bottom(nullptr), bottom_limit(nullptr), frame(nullptr) {
-        const_cast<size_t &>(limit) = get_stack_limit(include, exclude) + limit_for_error;
-        get_stack_info(const_cast<stack_check *>(&info)->top, const_cast<stack_check *>(&info)->bottom);
-        *const_cast<void **>(&info.bottom_limit) = static_cast<char *>(info.bottom) + limit;
+    STACK_CHECK_TLS_MODEL static constinit thread_local stack_check info;
+
+    constexpr stack_check() = default;
+
+    stack_check(const AddrListType *include, const AddrListType *exclude = nullptr) {
+        limit = get_stack_limit(include, exclude) + limit_for_error;
+        void *stack_bottom;
+        get_stack_info(top, stack_bottom);
+        bottom = reinterpret_cast<uintptr_t>(stack_bottom);
+        bottom_limit = bottom + limit;
+    }
+
+    /*
+     * Parameters of a stack allocated by the user in the memory region [stack, stack + size)
+     * (a fiber or a user-mode context), which are installed by @ref switch_stack when switching to it.
+     */
+    stack_check(void *stack, size_t size, const AddrListType *include = nullptr, const AddrListType *exclude = nullptr) {
+        limit = get_stack_limit(include, exclude) + limit_for_error;
+        top = static_cast<char *>(stack) + size;
+        bottom = reinterpret_cast<uintptr_t>(stack);
+        bottom_limit = bottom + limit;
     }
 
     static bool get_stack_info(void *&top, void *&bottom);
     static size_t get_stack_limit(const AddrListType *include = nullptr, const AddrListType *exclude = nullptr);
 
-    static inline size_t get_stack_size() { return static_cast<char *>(info.top) - static_cast<char *>(info.bottom); }
+    inline bool is_initialized() const { return top != nullptr; }
+
+    // The current position on the stack to compare with the bounds (the frame address or the stack pointer)
+    [[gnu::always_inline]] static inline uintptr_t get_stack_address() {
+#ifdef STACK_CHECK_STACK_POINTER
+#if __has_builtin(__builtin_stack_address)
+        return reinterpret_cast<uintptr_t>(__builtin_stack_address());
+#elif defined(__x86_64__)
+        uintptr_t sp;
+        asm("movq %%rsp, %0" : "=r"(sp));
+        return sp;
+#elif defined(__aarch64__)
+        uintptr_t sp;
+        asm("mov %0, sp" : "=r"(sp));
+        return sp;
+#else
+#error "The STACK_CHECK_STACK_POINTER mode is not supported for this platform!"
+#endif
+#else
+        return reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+#endif
+    }
+
+    // Per-thread initialization of the stack parameters (performed automatically on the first check in the thread)
+    static void init_thread(const AddrListType *include = nullptr, const AddrListType *exclude = nullptr) {
+        stack_overflow::message();
+        const uintptr_t lowest = info.lowest;
+        info = stack_check(include, exclude);
+        info.lowest = lowest;
+    }
+
+    // Recording the lowest stack address (a high-water mark of the stack usage)
+    [[gnu::always_inline]] static inline void update_lowest([[maybe_unused]] const uintptr_t address) {
+#ifdef STACK_CHECK_HIGH_WATER_MARK
+        if (address < info.lowest) {
+            info.lowest = address;
+        }
+#endif
+    }
+
+    /*
+     * The peak stack usage of the current thread (from the top of the stack to the lowest address seen by the checks).
+     * Returns 0 if no check has been performed yet or the program is compiled without STACK_CHECK_HIGH_WATER_MARK.
+     */
+    static inline size_t max_used() {
+        if (!info.is_initialized() || info.lowest > reinterpret_cast<uintptr_t>(info.top)) {
+            return 0;
+        }
+        return reinterpret_cast<uintptr_t>(info.top) - info.lowest;
+    }
+
+    // Resetting the high-water mark, for example, before measuring the next load period
+    static inline void reset_max_used() { info.lowest = UINTPTR_MAX; }
+
+    /*
+     * Switching the stack of the current thread (e.g. when switching the context of a fiber).
+     * The parameters of the stack being switched to are copied into the thread-local variable,
+     * and the current ones are saved to @p from, so that the next call can restore them.
+     * The check functions do not depend on the switching and work unchanged.
+     * The high-water mark is switched together with the bounds, so it is kept separately for each stack
+     * in its stack_check object, and @ref max_used reports only the stack currently in use. The mark of a stack
+     * that is not saved to @p from (e.g. a segment of @ref stack_segment::call) is discarded.
+     */
+    static inline void switch_stack(const stack_check &to, stack_check *from = nullptr) {
+        if (from) {
+            *from = info;
+        }
+        info = to;
+    }
+
+    static inline size_t get_stack_size() {
+        if (!info.is_initialized()) {
+            init_thread();
+        }
+        return static_cast<char *>(info.top) - reinterpret_cast<char *>(info.bottom);
+    }
 
     static inline size_t get_free_stack_space() {
-        if (static_cast<char *>(__builtin_frame_address(0)) > static_cast<char *>(info.bottom)) {
-            return static_cast<char *>(__builtin_frame_address(0)) - static_cast<char *>(info.bottom);
+        if (!info.is_initialized()) {
+            init_thread();
+        }
+        if (get_stack_address() > info.bottom) {
+            return get_stack_address() - info.bottom;
         }
         return 0;
     }
 
     static inline void check_overflow(const size_t size) {
-        if (static_cast<char *>(__builtin_frame_address(0)) < (static_cast<char *>(info.bottom) + size)) {
-            throw_stack_overflow(size, info);
+        const uintptr_t address = get_stack_address();
+        update_lowest(address);
+        if (address < info.bottom + size) {
+            check_overflow_failed(size);
         }
     }
 
@@ -105,14 +294,140 @@ struct stack_check {
      */
     static inline void check_limit() {
         // No need for addition operator before comparison and more opportunities for optimization
-        if (static_cast<char *>(__builtin_frame_address(0)) < (static_cast<char *>(info.bottom_limit))) {
-            throw_stack_overflow(info.limit, info);
+        const uintptr_t address = get_stack_address();
+        update_lowest(address);
+        if (address < info.bottom_limit) {
+            check_limit_failed();
+        }
+    }
+
+    /*
+     * Non-throwing checks (also for code compiled with -fno-exceptions).
+     * They return false if there is not enough free space on the stack, so the caller can switch to a fallback.
+     */
+    [[nodiscard]] static inline bool try_check_overflow(const size_t size) {
+        const uintptr_t address = get_stack_address();
+        update_lowest(address);
+        if (address < info.bottom + size) {
+            return try_check_overflow_failed(size);
+        }
+        return true;
+    }
+
+    [[nodiscard]] static inline bool try_check_limit() {
+        const uintptr_t address = get_stack_address();
+        update_lowest(address);
+        if (address < info.bottom_limit) {
+            return try_check_limit_failed();
+        }
+        return true;
+    }
+
+    /*
+     * Instrumented checks that are inserted by the plugin with the `counters` argument.
+     * In addition to the check, they count the calls and record the minimum free stack space at the call site.
+     * The counters are updated with relaxed atomic loads and stores, so concurrent calls may lose increments,
+     * but this does not require locked instructions.
+     */
+    static inline void check_overflow_site(const size_t size, stack_check_site *site) {
+        check_overflow(size);
+        update_site(site);
+    }
+
+    static inline void check_limit_site(stack_check_site *site) {
+        check_limit();
+        update_site(site);
+    }
+
+    /*
+     * Checks with the frame size of the called function resolved from the `.stack_sizes` section,
+     * which are inserted by the plugin for functions annotated with `STACK_CHECK_SIZE(0)`.
+     */
+    static inline void check_overflow_frame(stack_check_frame *frame) {
+        const uintptr_t address = get_stack_address();
+        update_lowest(address);
+        if (address < info.bottom + __atomic_load_n(&frame->size, __ATOMIC_RELAXED)) {
+            check_frame_failed(frame);
         }
     }
 
-    [[clang::optnone]] static void throw_stack_overflow [[noreturn]] (const size_t size, const stack_check &info) {
+    static inline void check_overflow_frame_site(stack_check_frame *frame, stack_check_site *site) {
+        check_overflow_frame(frame);
+        update_site(site);
+    }
+
+    static size_t resolve_frame(stack_check_frame *frame);
+
+    static inline void update_site(stack_check_site *site) {
+        const uint64_t count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->count, count + 1, __ATOMIC_RELAXED);
+        if (!count) {
+            register_sites_dump();
+        }
+        const uint64_t free = get_stack_address() - info.bottom;
+        if (free < __atomic_load_n(&site->min_free, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&site->min_free, free, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Output of the call site counters (on demand, or at exit after the first instrumented check)
+    static void dump_sites(FILE *out);
+    static void register_sites_dump();
+
+    /*
+     * The slow paths of the checks are taken out of the inline code.
+     * On the first check in the thread, they initialize the stack parameters and repeat the check.
+     */
+    [[gnu::noinline, gnu::cold]] static void check_overflow_failed(const size_t size) {
+        if (!info.is_initialized()) {
+            init_thread();
+            if (get_stack_address() >= info.bottom + size) {
+                return;
+            }
+        }
+        throw_stack_overflow(size, info);
+    }
+
+    [[gnu::noinline, gnu::cold]] static void check_frame_failed(stack_check_frame *frame) {
+        size_t size = __atomic_load_n(&frame->size, __ATOMIC_RELAXED);
+        if (size == stack_check_frame::unresolved) {
+            size = resolve_frame(frame);
+        }
+        if (get_stack_address() < info.bottom + size) {
+            check_overflow_failed(size);
+        }
+    }
+
+    [[gnu::noinline, gnu::cold]] static void check_limit_failed() {
+        if (!info.is_initialized()) {
+            init_thread();
+            if (get_stack_address() >= info.bottom_limit) {
+                return;
+            }
+        }
+        throw_stack_overflow(info.limit, info);
+    }
+
+    [[gnu::noinline, gnu::cold]] static bool try_check_overflow_failed(const size_t size) {
+        if (!info.is_initialized()) {
+            init_thread();
+            return get_stack_address() >= info.bottom + size;
+        }
+        return false;
+    }
+
+    [[gnu::noinline, gnu::cold]] static bool try_check_limit_failed() {
+        if (!info.is_initialized()) {
+            init_thread();
+            return get_stack_address() >= info.bottom_limit;
+        }
+        return false;
+    }
+
+    // Kept out of line so that the recorded frame is the frame of the throwing function
+    [[gnu::noinline, gnu::cold]] static void throw_stack_overflow [[noreturn]] (const size_t size, const stack_check &info) {
         *const_cast<void **>(&info.frame) = __builtin_frame_address(0);
-        throw stack_overflow(size, &info);
+        STACK_CHECK_THROW(stack_overflow(size, &info));
     }
 
     /**
@@ -121,9 +436,22 @@ struct stack_check {
      * by the plugin (using the @ref STACK_CHECK_SIZE macro).
      * A value of 0 disables ignoring checks.
      */
-    [[clang::optnone]] static void ignore_next_check(const size_t size) {}
+    [[clang::optnone]] static void ignore_next_check([[maybe_unused]] const size_t size) {}
 };
 
+STACK_CHECK_TLS_MODEL inline constinit thread_local stack_check stack_check::info;
+
+/*
+ * The plugin inserts calls to the check functions after the front end has finished,
+ * so references to them are kept in each translation unit to force their definitions to be emitted.
+ */
+[[gnu::used]] static const void *const stack_check_functions[] = {reinterpret_cast<const void *>(&stack_check::check_overflow),
+                                                                   reinterpret_cast<const void *>(&stack_check::check_limit),
+                                                                   reinterpret_cast<const void *>(&stack_check::check_overflow_site),
+                                                                   reinterpret_cast<const void *>(&stack_check::check_limit_site),
+                                                                   reinterpret_cast<const void *>(&stack_check::check_overflow_frame),
+                                                                   reinterpret_cast<const void *>(&stack_check::check_overflow_frame_site)};
+
 /*
  * Tag types for constructor and destructor
  */
@@ -193,13 +521,26 @@ size_t get_free_stack_space() {
 
 #else
 
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
 #include <elf.h>
+#include <exception>
 #include <fcntl.h>
 #include <link.h>
+#include <mutex>
+#include <optional>
 #include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <string>
 #include <string_view>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <type_traits>
+#include <ucontext.h>
 #include <unistd.h>
 
 namespace trust {
@@ -216,49 +557,14 @@ inline bool trust::stack_check::get_stack_info(void *&top, void *&bottom) {
 
     top = static_cast<char *>(bottom) + stack_size;
 
-    // Explicitly calling control functions prevents the linker from removing
-    // them during optimization due to the lack of direct calls in other code.
-    check_limit();
-    check_overflow(stack_check::limit_for_error);
-
     return top > bottom;
 }
 
-// Helper structures for managing mapped ELF file
-struct MappedELF {
-    void *mapped;
-    size_t size;
-
-    MappedELF() : mapped(nullptr), size(0) {
-
-        int fd = open("/proc/self/exe", O_RDONLY);
-        if (fd < 0) {
-            throw std::runtime_error("Error open file '/proc/self/exe'!");
-        }
-
-        struct stat st;
-        if (fstat(fd, &st) < 0) {
-            close(fd);
-            throw std::runtime_error("Error call 'fstat'!");
-        }
-
-        mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-        close(fd);
-        if (mapped == MAP_FAILED) {
-            mapped = nullptr;
-            throw std::runtime_error("Error call 'mmap'!");
-        }
-        size = st.st_size;
-    }
-
-    ~MappedELF() {
-        if (mapped) {
-            munmap(mapped, size);
-        }
-    }
+// Common helpers for reading ELF files of the current process
+struct ELFFile {
 
     // Get base address via dl_iterate_phdr
-    uint64_t get_base_address_dl() const {
+    static uint64_t get_base_address_dl() {
         struct BaseAddrContext {
             uint64_t base_addr;
             bool found;
@@ -267,7 +573,7 @@ struct MappedELF {
         BaseAddrContext ctx = {0, false};
 
         dl_iterate_phdr(
-            [](struct dl_phdr_info *info, size_t size, void *data) -> int {
+            [](struct dl_phdr_info *info, [[maybe_unused]] size_t size, void *data) -> int {
                 BaseAddrContext *ctx = (BaseAddrContext *)data;
                 // Main program has an empty name
                 if (info->dlpi_name == nullptr || info->dlpi_name[0] == '\0') {
@@ -296,6 +602,40 @@ struct MappedELF {
 
         return result;
     }
+};
+
+// Helper structures for managing mapped ELF file
+struct MappedELF : public ELFFile {
+    void *mapped;
+    size_t size;
+
+    MappedELF(const char *path = "/proc/self/exe") : mapped(nullptr), size(0) {
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            STACK_CHECK_THROW(std::runtime_error(std::format("Error open file '{}'!", path)));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            STACK_CHECK_THROW(std::runtime_error("Error call 'fstat'!"));
+        }
+
+        mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            mapped = nullptr;
+            STACK_CHECK_THROW(std::runtime_error("Error call 'mmap'!"));
+        }
+        size = st.st_size;
+    }
+
+    ~MappedELF() {
+        if (mapped) {
+            munmap(mapped, size);
+        }
+    }
 
     bool GetSection(std::string_view view, const uint8_t *&data, size_t &size) const {
         // Find .stack_sizes section immediately
@@ -317,113 +657,802 @@ struct MappedELF {
     }
 };
 
+/*
+ * Reading ELF file sections without mapping the entire file into memory.
+ * Only the ELF header, the section header table, the section name table
+ * and the requested sections are read from the file.
+ */
+struct ReadELF : public ELFFile {
+    int fd;
+    Elf64_Ehdr ehdr;
+    std::vector<Elf64_Shdr> shdr;
+    std::vector<char> shstrtab;
+
+    ReadELF(const char *path = "/proc/self/exe") : fd(-1), ehdr{} {
+        std::string error = Open(path);
+        if (!error.empty()) {
+            STACK_CHECK_THROW(std::runtime_error(error));
+        }
+    }
+
+    // Opening without throwing an exception (the error message is returned in @p error)
+    ReadELF(const char *path, std::string &error) : fd(-1), ehdr{} { error = Open(path); }
+
+    std::string Open(const char *path) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return std::format("Error open file '{}'!", path);
+        }
+
+        std::string error;
+        if (!ReadAt(&ehdr, sizeof(ehdr), 0) || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+            ehdr.e_shentsize != sizeof(Elf64_Shdr) || ehdr.e_shstrndx >= ehdr.e_shnum) {
+            error = std::format("File '{}' is not a 64-bit ELF file!", path);
+        } else {
+            shdr.resize(ehdr.e_shnum);
+            if (!ReadAt(shdr.data(), shdr.size() * sizeof(Elf64_Shdr), ehdr.e_shoff)) {
+                error = "Error reading the section header table!";
+            } else {
+                shstrtab.resize(shdr[ehdr.e_shstrndx].sh_size + 1);
+                if (!ReadAt(shstrtab.data(), shstrtab.size() - 1, shdr[ehdr.e_shstrndx].sh_offset)) {
+                    error = "Error reading the section name table!";
+                }
+            }
+        }
+
+        if (!error.empty()) {
+            close(fd);
+            fd = -1;
+        }
+        return error;
+    }
+
+    ~ReadELF() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    ReadELF(const ReadELF &) = delete;
+    ReadELF &operator=(const ReadELF &) = delete;
+
+    bool ReadAt(void *buffer, size_t size, off_t offset) const {
+        char *ptr = static_cast<char *>(buffer);
+        while (size) {
+            ssize_t count = pread(fd, ptr, size, offset);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            } else if (count <= 0) {
+                return false;
+            }
+            ptr += count;
+            offset += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool GetSection(std::string_view view, std::vector<uint8_t> &data) const {
+        for (auto &section : shdr) {
+            if (section.sh_name >= shstrtab.size()) {
+                continue;
+            }
+            const char *name = shstrtab.data() + section.sh_name;
+
+            if (!view.empty() && view.compare(name) == 0) {
+                data.resize(section.sh_size);
+                return ReadAt(data.data(), data.size(), section.sh_offset);
+            }
+        }
+        return false;
+    }
+};
+
+// An entry of the stack sizes index: the function address in the process memory and its stack frame size
+struct StackSizeEntry {
+    uint64_t addr;
+    uint64_t size;
+
+    bool operator<(const StackSizeEntry &other) const { return addr < other.addr; }
+};
+
 // Structure to hold stack sizes section data
-struct StackSizesSection : public MappedELF {
+struct StackSizesSection : public ELFFile {
 
-    const uint8_t *data;
     size_t size;
+    uint64_t base_addr;
+    uint64_t max_size;
+    // The section is decoded only once into an array sorted by function address
+    std::vector<StackSizeEntry> entries;
+
+    StackSizesSection() : StackSizesSection(ReadELF()) {}
+
+    // The section of a loaded object, whose function addresses are relative to its base address.
+    // If the section is not required, an object without it gives an empty list of functions.
+    explicit StackSizesSection(const ReadELF &elf, uint64_t base = get_base_address_dl(), bool required = true)
+        : size(0), base_addr(base), max_size(0) {
+        std::vector<uint8_t> data;
+        if (elf.GetSection(".stack_sizes", data)) {
+            Parse(data.data(), data.size());
+        } else if (required) {
+            STACK_CHECK_THROW(std::runtime_error("Section '.stack_sizes' not found! Use the -fstack-size-section option when compiling."));
+        }
+    }
 
-    StackSizesSection() : data(nullptr), size(0) {
-        if (!GetSection(".stack_sizes", data, size)) {
-            throw std::runtime_error("Section '.stack_sizes' not found! Use the -fstack-size-section option when compiling.");
+    explicit StackSizesSection(const MappedELF &elf) : size(0), base_addr(get_base_address_dl()), max_size(0) {
+        const uint8_t *data;
+        size_t data_size;
+        if (!elf.GetSection(".stack_sizes", data, data_size)) {
+            STACK_CHECK_THROW(std::runtime_error("Section '.stack_sizes' not found! Use the -fstack-size-section option when compiling."));
         }
+        Parse(data, data_size);
     }
 
-  public:
-    // Get a list of addresses of all functions of an executable file
-    trust::AddrListType getAddrList() {
-        trust::AddrListType result;
+    // Decoding the section contents already read into memory
+    StackSizesSection(const uint8_t *data, size_t data_size, uint64_t base) : size(0), base_addr(base), max_size(0) {
+        Parse(data, data_size);
+    }
+
+    // Adding the functions of another object (the address ranges of different objects do not overlap)
+    void Add(const StackSizesSection &other) {
+        size_t middle = entries.size();
+        entries.insert(entries.end(), other.entries.begin(), other.entries.end());
+        std::inplace_merge(entries.begin(), entries.begin() + middle, entries.end());
+        size += other.size;
+        max_size = std::max(max_size, other.max_size);
+    }
+
+    // Get the maximum stack size of the functions from the include list (or all functions) except for the exclude list
+    uint64_t GetLimit(const trust::AddrListType *include = nullptr, const trust::AddrListType *exclude = nullptr) const;
+
+  private:
+    void Parse(const uint8_t *data, size_t data_size) {
+        size = data_size;
 
         const uint8_t *ptr = data;
         const uint8_t *end = data + size;
-        uint64_t base_addr = get_base_address_dl();
-
         while (ptr < end) {
-            uint64_t addr = *(uint64_t *)ptr;
+            uint64_t addr;
+            memcpy(&addr, ptr, sizeof(addr));
+            ptr += 8;
+            uint64_t frame = ELFFile::decode_uleb128(&ptr);
 
-            result.push_back((void *)(addr + base_addr));
+            entries.push_back({addr + base_addr, frame});
+        }
 
-            ptr += 8;
-            MappedELF::decode_uleb128(&ptr);
+        std::sort(entries.begin(), entries.end());
+        // Folded functions can have several records with the same address, only the largest size is kept
+        size_t count = 0;
+        for (auto &entry : entries) {
+            if (count && entries[count - 1].addr == entry.addr) {
+                entries[count - 1].size = std::max(entries[count - 1].size, entry.size);
+            } else {
+                entries[count++] = entry;
+            }
+            max_size = std::max(max_size, entry.size);
+        }
+        entries.resize(count);
+    }
+
+  public:
+    // Iterate over all functions of an executable file without creating an address list
+    std::vector<StackSizeEntry>::const_iterator begin() const { return entries.begin(); }
+    std::vector<StackSizeEntry>::const_iterator end() const { return entries.end(); }
+
+    // Find the index entry for a given function address (nullptr if the function is not found)
+    const StackSizeEntry *find(const void *func_addr) const {
+        auto iter = std::lower_bound(entries.begin(), entries.end(), StackSizeEntry{(uint64_t)func_addr, 0});
+        if (iter != entries.end() && iter->addr == (uint64_t)func_addr) {
+            return &*iter;
+        }
+        return nullptr;
+    }
+
+    // Get a list of addresses of all functions of an executable file
+    trust::AddrListType getAddrList() const {
+        trust::AddrListType result;
+        result.reserve(entries.size());
+        for (auto &entry : entries) {
+            result.push_back((void *)entry.addr);
         }
         return result;
     }
 
     // Helper function to find stack size for a given function address
     uint64_t getStackSize(void *func_addr, bool *found = nullptr) const {
-        if (!data)
-            return 0;
+        const StackSizeEntry *entry = find(func_addr);
+        if (found) {
+            *found = entry != nullptr;
+        }
+        return entry ? entry->size : 0;
+    }
+};
 
-        const uint8_t *ptr = data;
-        const uint8_t *end = data + size;
+inline uint64_t StackSizesSection::GetLimit(const trust::AddrListType *include, const trust::AddrListType *exclude) const {
+    const StackSizesSection &stacks = *this;
+
+    if (include) {
+        for (auto ptr : *include) {
+            if (!stacks.find(ptr)) {
+                STACK_CHECK_THROW(std::runtime_error(std::format(
+                    "The function or class method with address {:#012x} was not found in the application's function list!", (size_t)ptr)));
+            }
+        }
+    }
+    if (!exclude || exclude->empty()) {
+        if (!include) {
+            return stacks.max_size;
+        }
+        uint64_t max_size = 0;
+        for (auto ptr : *include) {
+            max_size = std::max(max_size, stacks.getStackSize(ptr));
+        }
+        return max_size;
+    }
 
-        // Calculate relative address (as in ELF file)
-        uint64_t relative = (uint64_t)func_addr - get_base_address_dl();
+    trust::AddrListType skip(*exclude);
+    std::sort(skip.begin(), skip.end());
 
-        while (ptr < end) {
-            uint64_t addr = *(uint64_t *)ptr;
-            ptr += 8;
-            uint64_t size = decode_uleb128(&ptr);
+    uint64_t max_size = 0;
+    if (include) {
+        for (auto ptr : *include) {
+            if (!std::binary_search(skip.begin(), skip.end(), ptr)) {
+                max_size = std::max(max_size, stacks.getStackSize(ptr));
+            }
+        }
+    } else {
+        for (auto &entry : stacks) {
+            if (entry.size > max_size && !std::binary_search(skip.begin(), skip.end(), (void *)entry.addr)) {
+                max_size = entry.size;
+            }
+        }
+    }
+    return max_size;
+}
 
-            // Compare relative address
-            if (addr == relative) {
-                if (found) {
-                    *found = true;
+/*
+ * Index of the `.stack_sizes` sections of all objects loaded into the process: the executable file
+ * and shared libraries, including those loaded with `dlopen`. It is built on first use and shared
+ * by all threads. The loader counters are checked on each query, so only newly loaded objects
+ * are read, and the functions of unloaded objects are removed without reading the remaining ones again.
+ * The limit without the include and exclude lists, which is requested by each new thread, is cached together
+ * with the loader counters. Reading the counters still takes the loader lock in `dl_iterate_phdr`, but stops
+ * at the first object, so a new thread takes the index lock and reads the object files only after `dlopen` or `dlclose`.
+ */
+struct StackSizesIndex {
+    struct Object {
+        std::string name;
+        uint64_t base_addr;
+        StackSizesSection section;
+    };
+
+    std::mutex mutex;
+    std::vector<Object> objects;
+    // Functions of all loaded objects sorted by address
+    StackSizesSection stacks;
+    bool loaded;
+    unsigned long long adds;
+    unsigned long long subs;
+
+    // The cached limit and its loader counters, the version is odd while they are written (and zero until the first write)
+    std::atomic<uint64_t> cache_version;
+    std::atomic<uint64_t> cache_limit;
+    std::atomic<unsigned long long> cache_adds;
+    std::atomic<unsigned long long> cache_subs;
+
+    StackSizesIndex()
+        : stacks(nullptr, 0, 0), loaded(false), adds(0), subs(0), cache_version(0), cache_limit(0), cache_adds(0), cache_subs(0) {}
+
+    static StackSizesIndex &instance() {
+        static StackSizesIndex index;
+        return index;
+    }
+
+    uint64_t GetLimit(const trust::AddrListType *include = nullptr, const trust::AddrListType *exclude = nullptr) {
+        const bool cached = !include && !exclude;
+        if (cached) {
+            // Only the counters are read (the iteration stops at the first object)
+            LoadedObjects current = {true, 0, 0, {}};
+            dl_iterate_phdr(&Iterate, &current);
+
+            const uint64_t version = cache_version.load(std::memory_order_acquire);
+            if (version && !(version & 1) && cache_adds.load(std::memory_order_relaxed) == current.adds &&
+                cache_subs.load(std::memory_order_relaxed) == current.subs) {
+                const uint64_t limit = cache_limit.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (cache_version.load(std::memory_order_relaxed) == version) {
+                    return limit;
                 }
-                return size;
             }
         }
-        if (found) {
-            *found = false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Update();
+        const uint64_t limit = stacks.GetLimit(include, exclude);
+        if (cached) {
+            const uint64_t version = cache_version.load(std::memory_order_relaxed);
+            cache_version.store(version + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            cache_limit.store(limit, std::memory_order_relaxed);
+            cache_adds.store(adds, std::memory_order_relaxed);
+            cache_subs.store(subs, std::memory_order_relaxed);
+            cache_version.store(version + 2, std::memory_order_release);
+        }
+        return limit;
+    }
+
+    uint64_t getStackSize(void *func_addr, bool *found = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Update();
+        return stacks.getStackSize(func_addr, found);
+    }
+
+    uint64_t getMaxSize() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Update();
+        return stacks.max_size;
+    }
+
+    size_t getObjectCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Update();
+        return objects.size();
+    }
+
+  private:
+    struct LoadedObjects {
+        bool counters_only;
+        unsigned long long adds;
+        unsigned long long subs;
+        std::vector<std::pair<std::string, uint64_t>> list;
+    };
+
+    static int Iterate(struct dl_phdr_info *info, size_t size, void *data) {
+        LoadedObjects *loaded = (LoadedObjects *)data;
+        if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+            loaded->adds = info->dlpi_adds;
+            loaded->subs = info->dlpi_subs;
+        }
+        if (loaded->counters_only) {
+            return 1; // The counters are the same for all objects
         }
+        loaded->list.emplace_back(info->dlpi_name ? info->dlpi_name : "", info->dlpi_addr);
         return 0;
     }
-};
 
-// Get the maximum stack size to check before calling functions
-inline size_t trust::stack_check::get_stack_limit(const trust::AddrListType *include, const trust::AddrListType *exclude) {
-    trust::StackSizesSection stacks;
-    trust::AddrListType all_list = stacks.getAddrList();
-    if (!include) {
-        include = &all_list;
-    } else {
-        bool found;
-        for (auto ptr : *include) {
-            found = false;
-            for (auto func : all_list) {
-                if (ptr == func) {
+    // Index newly loaded objects and remove unloaded ones (called under the lock)
+    void Update() {
+        LoadedObjects current = {true, 0, 0, {}};
+        dl_iterate_phdr(&Iterate, &current);
+        if (loaded && current.adds == adds && current.subs == subs) {
+            return;
+        }
+
+        current.counters_only = false;
+        dl_iterate_phdr(&Iterate, &current);
+
+        auto is_loaded = [&current](const Object &obj) {
+            for (auto &elem : current.list) {
+                if (elem.first == obj.name && elem.second == obj.base_addr) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        size_t count = objects.size();
+        std::erase_if(objects, [&is_loaded](const Object &obj) { return !is_loaded(obj); });
+        if (count != objects.size()) {
+            stacks = StackSizesSection(nullptr, 0, 0);
+            for (auto &obj : objects) {
+                stacks.Add(obj.section);
+            }
+        }
+
+        for (auto &elem : current.list) {
+            bool found = false;
+            for (auto &obj : objects) {
+                if (elem.first == obj.name && elem.second == obj.base_addr) {
                     found = true;
                     break;
                 }
             }
-            if (!found) {
-                throw std::runtime_error(std::format(
-                    "The function or class method with address {:#012x} was not found in the application's function list!", (size_t)ptr));
+            if (found) {
+                continue;
             }
+
+            // The main program has an empty name and must contain the section
+            bool is_main = elem.first.empty();
+            std::string error;
+            ReadELF elf(is_main ? "/proc/self/exe" : elem.first.c_str(), error);
+            if (error.empty()) {
+                objects.push_back({elem.first, elem.second, StackSizesSection(elf, elem.second, is_main)});
+            } else if (is_main) {
+                STACK_CHECK_THROW(std::runtime_error(error));
+            } else {
+                // Objects without a file (vdso) are remembered with an empty list of functions
+                objects.push_back({elem.first, elem.second, StackSizesSection(nullptr, 0, elem.second)});
+            }
+            stacks.Add(objects.back().section);
         }
+
+        loaded = true;
+        adds = current.adds;
+        subs = current.subs;
     }
-    bool skip;
-    uint64_t max_size = 0;
-    for (size_t i = 0; i < include->size(); i++) {
-        skip = false;
-        if (exclude) {
-            for (size_t pos = 0; pos < exclude->size(); pos++) {
-                if ((*exclude)[pos] == (*include)[i]) {
-                    skip = true;
-                    break;
+};
+
+// Get the maximum stack size to check before calling functions
+inline size_t trust::stack_check::get_stack_limit(const trust::AddrListType *include, const trust::AddrListType *exclude) {
+    return StackSizesIndex::instance().GetLimit(include, exclude);
+}
+
+// The frame size is looked up in the sections of all loaded objects, concurrent threads store the same value
+inline size_t trust::stack_check::resolve_frame(stack_check_frame *frame) {
+    bool found = false;
+    const uint64_t size = StackSizesIndex::instance().getStackSize(const_cast<void *>(frame->func), &found);
+    if (!found) {
+        STACK_CHECK_THROW(std::runtime_error(
+            std::format("The frame size of the function with address {:#012x} was not found! Use the -fstack-size-section option when compiling.",
+                        (size_t)frame->func)));
+    }
+    __atomic_store_n(&frame->size, size, __ATOMIC_RELAXED);
+    return size;
+}
+
+// Bounds of the `stack_check_sites` section of the current object (created by the linker)
+extern "C" [[gnu::weak, gnu::visibility("hidden")]] stack_check_site __start_stack_check_sites[];
+extern "C" [[gnu::weak, gnu::visibility("hidden")]] stack_check_site __stop_stack_check_sites[];
+
+inline void trust::stack_check::dump_sites(FILE *out) {
+    for (stack_check_site *site = __start_stack_check_sites; site < __stop_stack_check_sites; site++) {
+        int status = 0;
+        char *callee = site->callee ? abi::__cxa_demangle(site->callee, nullptr, nullptr, &status) : nullptr;
+        const uint64_t count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+        const uint64_t min_free = __atomic_load_n(&site->min_free, __ATOMIC_RELAXED);
+        fprintf(out, "%s:%lu: %s: calls %lu, min free %lu\n", site->file ? site->file : "<unknown>", (unsigned long)site->line,
+                callee ? callee : (site->callee ? site->callee : "<unknown>"), (unsigned long)count,
+                count ? (unsigned long)min_free : 0UL);
+        free(callee);
+    }
+    fflush(out);
+}
+
+/*
+ * The counters are dumped at exit to the file specified in the STACK_CHECK_SITES environment variable,
+ * or to stderr if it is not set.
+ */
+inline void trust::stack_check::register_sites_dump() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        atexit([]() {
+            const char *path = getenv("STACK_CHECK_SITES");
+            FILE *out = path && *path ? fopen(path, "w") : stderr;
+            if (out) {
+                dump_sites(out);
+                if (out != stderr) {
+                    fclose(out);
                 }
             }
+        });
+    });
+}
+
+/*
+ * Stack overflow control without checks on the call path (guard page mode).
+ *
+ * The function passed to @ref stack_guard::call runs without explicit checks, and a stack overflow
+ * is caught as a fault on the guard page of the thread's stack. The SIGSEGV handler runs on an alternate
+ * signal stack, and if the fault address lies in the stack region tracked by @ref stack_check::info
+ * or in the guard area right below it (the guard size of the thread, at least one page), it returns to stack_guard::call,
+ * which throws the same @ref stack_overflow exception as the explicit checks. Other faults, including those
+ * in the mappings further below the stack, are passed to the previous handler.
+ *
+ * The stack frames of the guarded function are discarded without calling destructors,
+ * so objects created in them must not own resources. The return from the signal handler is a `siglongjmp`,
+ * and the fault often happens inside a callee (malloc, stdio, GMP), which is not async-signal-safe:
+ * its locks can stay held and the heap can be left inconsistent. So the guarded function must not call
+ * such library code when the stack may be close to the limit. A function frame larger than the guard area
+ * can skip the guard page, in which case the overflow is not detected. Both modes can be used in the same program:
+ * the explicit checks keep working inside stack_guard::call.
+ */
+struct stack_guard {
+    static constexpr size_t alt_stack_size = 64 * 1024;
+
+    static inline constinit thread_local sigjmp_buf *jump = nullptr;
+    // The size of the guard area below the stack bottom (zero until the thread is initialized)
+    static inline constinit thread_local size_t guard_size = 0;
+
+    /*
+     * Setting the signal handler (once per process) and the alternate signal stack (once per thread).
+     * An alternate signal stack already set by the application or a sanitizer is kept.
+     */
+    static void init_thread() {
+        static std::once_flag once;
+        std::call_once(once, []() {
+            struct sigaction action = {};
+            action.sa_sigaction = signal_handler;
+            action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(SIGSEGV, &action, &previous())) {
+                STACK_CHECK_THROW(std::runtime_error(std::format("Error setting the SIGSEGV handler: {}", strerror(errno))));
+            }
+        });
+
+        if (!stack_check::info.is_initialized()) {
+            stack_check::init_thread();
+        }
+        thread_alt_stack.init();
+
+        size_t guard = 0;
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            pthread_attr_getguardsize(&attr, &guard);
+            pthread_attr_destroy(&attr);
+        }
+        guard_size = std::max<size_t>(guard, sysconf(_SC_PAGESIZE));
+    }
+
+    template <typename F> static void call(F &&func) {
+        if (!guard_size) [[unlikely]] {
+            init_thread();
+        }
+
+        sigjmp_buf buf;
+        sigjmp_buf *const prev = jump;
+        if (sigsetjmp(buf, 1)) {
+            jump = prev;
+            stack_check::throw_stack_overflow(0, stack_check::info);
+        }
+        jump = &buf;
+#ifdef __cpp_exceptions
+        try {
+            func();
+        } catch (...) {
+            jump = prev;
+            throw;
+        }
+#else
+        func();
+#endif
+        jump = prev;
+    }
+
+    /*
+     * A fault in the tracked stack region (the main thread's stack cannot grow there near another mapping)
+     * or in the guard area [bottom - guard_size, bottom) is a stack overflow.
+     */
+    static bool is_stack_fault(const void *addr) {
+        const stack_check &info = stack_check::info;
+        uintptr_t fault = reinterpret_cast<uintptr_t>(addr);
+        return info.is_initialized() && guard_size && fault < reinterpret_cast<uintptr_t>(info.top) && fault + guard_size >= info.bottom;
+    }
+
+  private:
+    struct AltStack {
+        void *stack = nullptr;
+
+        void init() {
+            if (stack) {
+                return;
+            }
+            stack_t current = {};
+            if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+                return;
+            }
+            size_t size = std::max<size_t>(SIGSTKSZ, alt_stack_size);
+            void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                STACK_CHECK_THROW(std::runtime_error(std::format("Error allocating the alternate signal stack: {}", strerror(errno))));
+            }
+            stack_t ss = {};
+            ss.ss_sp = mem;
+            ss.ss_size = size;
+            if (sigaltstack(&ss, nullptr)) {
+                munmap(mem, size);
+                STACK_CHECK_THROW(std::runtime_error(std::format("Error setting the alternate signal stack: {}", strerror(errno))));
+            }
+            stack = mem;
         }
-        if (!skip) {
-            uint64_t curr_size = stacks.getStackSize((*include)[i]);
-            if (curr_size > max_size) {
-                max_size = curr_size;
+
+        ~AltStack() {
+            if (stack) {
+                stack_t ss = {};
+                ss.ss_flags = SS_DISABLE;
+                sigaltstack(&ss, nullptr);
+                munmap(stack, std::max<size_t>(SIGSTKSZ, alt_stack_size));
             }
         }
+    };
+
+    static thread_local AltStack thread_alt_stack;
+
+    static struct sigaction &previous() {
+        static struct sigaction action = {};
+        return action;
     }
 
-    return max_size;
-}
+    static void signal_handler(int sig, siginfo_t *si, void *context) {
+        if (jump && is_stack_fault(si->si_addr)) {
+            siglongjmp(*jump, 1);
+        }
+
+        // Not a stack overflow in the guarded function
+        struct sigaction &prev = previous();
+        if ((prev.sa_flags & SA_SIGINFO) && prev.sa_sigaction) {
+            prev.sa_sigaction(sig, si, context);
+        } else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+            prev.sa_handler(sig);
+        } else {
+            // The fault is repeated after returning from the handler and is processed by default
+            signal(sig, SIG_DFL);
+        }
+    }
+};
+
+inline thread_local stack_guard::AltStack stack_guard::thread_alt_stack;
+
+/*
+ * Segmented stack continuation.
+ *
+ * Instead of throwing @ref stack_overflow, @ref stack_segment::call runs the function on a new stack segment
+ * if the free space on the current stack is less than the requested size. The segment is taken from the pool
+ * of the current thread (or allocated with a guard page), the bounds in @ref stack_check::info are switched
+ * for the duration of the call, and then the execution returns to the original stack. Exceptions thrown
+ * by the function are passed to the caller. If there is enough free space, the function is simply called,
+ * and the cost is the same as the check of @ref stack_check::check_overflow.
+ */
+struct stack_segment {
+    static constexpr size_t default_size = 1024 * 1024;
+    static constexpr size_t pool_size = 4;
+
+    template <typename F> static std::invoke_result_t<F> call(const size_t size, F &&func) {
+        if (stack_check::get_stack_address() >= stack_check::info.bottom + size) [[likely]] {
+            return func();
+        }
+        return call_on_segment(size, std::forward<F>(func));
+    }
+
+    // Returns the number of segments cached in the pool of the current thread
+    static size_t pooled() { return thread_pool.segments.size(); }
+
+  private:
+    struct Segment {
+        void *memory;
+        size_t size;
+    };
+
+    struct Pool {
+        std::vector<Segment> segments;
+
+        ~Pool() {
+            for (auto &segment : segments) {
+                munmap(segment.memory, segment.size);
+            }
+        }
+    };
+
+    static thread_local Pool thread_pool;
+
+    // The function being called on the segment (passed to the context entry point through the thread-local variable)
+    using Entry = void (*)(void *);
+    static inline constinit thread_local Entry entry = nullptr;
+    static inline constinit thread_local void *entry_arg = nullptr;
+
+    static void start() { entry(entry_arg); }
+
+    static Segment alloc(size_t size) {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        size = (std::max(size, default_size) + page - 1) & ~(page - 1);
+
+        auto &segments = thread_pool.segments;
+        for (auto iter = segments.begin(); iter != segments.end(); iter++) {
+            if (iter->size >= size + page) {
+                Segment segment = *iter;
+                segments.erase(iter);
+                return segment;
+            }
+        }
+
+        // The lowest page of the segment is a guard page
+        void *memory = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (memory == MAP_FAILED) {
+            STACK_CHECK_THROW(std::runtime_error(std::format("Error allocating a stack segment: {}", strerror(errno))));
+        }
+        if (mprotect(memory, page, PROT_NONE)) {
+            const int error = errno;
+            munmap(memory, size + page);
+            STACK_CHECK_THROW(std::runtime_error(std::format("Error protecting the guard page of a stack segment: {}", strerror(error))));
+        }
+        return {memory, size + page};
+    }
+
+    static void release(const Segment &segment) {
+        if (thread_pool.segments.size() < pool_size) {
+            thread_pool.segments.push_back(segment);
+        } else {
+            munmap(segment.memory, segment.size);
+        }
+    }
+
+    template <typename F> static std::invoke_result_t<F> call_on_segment(const size_t size, F &&func) {
+        if (!stack_check::info.is_initialized()) {
+            stack_check::init_thread();
+            if (stack_check::get_stack_address() >= stack_check::info.bottom + size) {
+                return func();
+            }
+        }
+
+        using Result = std::invoke_result_t<F>;
+        static_assert(!std::is_reference_v<Result>, "Functions returning a reference are not supported");
+
+        struct Call {
+            F &func;
+            std::exception_ptr error;
+            std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>> result;
+
+            static void run(void *arg) {
+                Call &call = *static_cast<Call *>(arg);
+#ifdef __cpp_exceptions
+                try {
+                    call.invoke();
+                } catch (...) {
+                    call.error = std::current_exception();
+                }
+#else
+                call.invoke();
+#endif
+            }
+
+            void invoke() {
+                if constexpr (std::is_void_v<Result>) {
+                    func();
+                } else {
+                    result.emplace(func());
+                }
+            }
+        } call{func, nullptr, {}};
+
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const Segment segment = alloc(size + stack_check::info.limit);
+
+        // The bounds of the segment without the guard page
+        stack_check bounds;
+        bounds.bottom = reinterpret_cast<uintptr_t>(segment.memory) + page;
+        bounds.top = static_cast<char *>(segment.memory) + segment.size;
+        bounds.limit = stack_check::info.limit;
+        bounds.bottom_limit = bounds.bottom + bounds.limit;
+
+        ucontext_t caller;
+        ucontext_t callee;
+        getcontext(&callee);
+        callee.uc_stack.ss_sp = reinterpret_cast<void *>(bounds.bottom);
+        callee.uc_stack.ss_size = segment.size - page;
+        callee.uc_link = &caller;
+        makecontext(&callee, start, 0);
+
+        entry = &Call::run;
+        entry_arg = &call;
+
+        stack_check saved;
+        stack_check::switch_stack(bounds, &saved);
+        swapcontext(&caller, &callee);
+        stack_check::switch_stack(saved);
+
+        release(segment);
+
+#ifdef __cpp_exceptions
+        if (call.error) {
+            std::rethrow_exception(call.error);
+        }
+#endif
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*call.result);
+        }
+    }
+};
+
+inline thread_local stack_segment::Pool stack_segment::thread_pool;
 
 } // namespace trust
 
@@ -29,8 +29,10 @@
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 
+#include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PreprocessorOptions.h"
 #include <charconv>
+#include <cstdlib>
 #include <string_view>
 
 #pragma clang attribute push
@@ -43,17 +45,39 @@
 
 #include <string>
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/OptimizationLevel.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/GlobPattern.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include <dlfcn.h>
 
@@ -65,6 +89,18 @@ namespace {
 class TrustPlugin;
 static std::unique_ptr<TrustPlugin> plugin;
 static bool is_verbose = false;
+static bool is_counters = false;
+static bool is_coalesce = true;
+static bool is_hoist = true;
+static bool is_inline = true;
+static bool is_prologue = false;
+static bool is_recursion = false;
+static bool is_profile = false;
+// The name masks of the protected and excluded functions, compiled once from the plugin arguments
+static std::vector<std::pair<std::string, llvm::GlobPattern>> include_masks;
+static std::vector<std::pair<std::string, llvm::GlobPattern>> exclude_masks;
+// The options of the code generator of the translation unit (the `.stack_sizes` section is enabled for automatic frame sizes)
+static CodeGenOptions *codegen_options = nullptr;
 
 static void Verbose(SourceLocation loc, std::string_view str);
 
@@ -134,11 +170,10 @@ struct TrustAttrInfo : public ParsedAttrInfo {
 
         std::string annotate(Attr.getAttrName()->getName());
         size_t stack_size = literal->getValue().getZExtValue();
-        if (stack_size == 0 && annotate.compare(stack_check_size) == 0) {
-            S.Diag(Attr.getLoc(),
-                   S.getDiagnostics().getCustomDiagID(
-                       DiagnosticsEngine::Error, "I couldn't find a way to call MachineFunctionPass from an AST plugin or as a regular IR "
-                                                 "processing plugin, so automatic function stack size calculation is not supported yet."));
+        if (stack_size == 0 && annotate.compare(stack_check_size) == 0 && codegen_options && !codegen_options->StackSizeSection) {
+            // The frame size is known only after code generation, so it is resolved at runtime from the `.stack_sizes` section
+            codegen_options->StackSizeSection = true;
+            Verbose(Attr.getLoc(), "Enable the .stack_sizes section for the automatic frame size");
         }
 
         annotate += "=";
@@ -187,16 +222,29 @@ static std::string getCStringFromGlobal(const llvm::Value *V) {
     return CA->getAsCString().str();
 }
 
-static std::vector<std::string> getAnnotationsForValue(const llvm::Module &M, const llvm::Value *Target) {
-    std::vector<std::string> Out;
+/*
+ * Check parameters of an annotated function, parsed from the annotation string once per module.
+ */
+struct StackCheckAnnotation {
+    // Frame is the size 0, which is replaced by the frame size of the annotated function resolved at runtime
+    enum Kind : uint8_t { Size, Limit, Frame } kind;
+    size_t size;
+    std::string text;
+    const llvm::Function *func = nullptr;
+};
+
+typedef llvm::DenseMap<const llvm::Function *, llvm::SmallVector<StackCheckAnnotation, 1>> AnnotationIndex;
+
+static AnnotationIndex buildAnnotationIndex(const llvm::Module &M) {
+    AnnotationIndex Index;
 
     const llvm::GlobalVariable *GA = M.getNamedGlobal("llvm.global.annotations");
     if (!GA || !GA->hasInitializer())
-        return Out;
+        return Index;
 
     const auto *CA = dyn_cast<llvm::ConstantArray>(GA->getInitializer());
     if (!CA)
-        return Out;
+        return Index;
 
     for (const llvm::Use &Op : CA->operands()) {
         const auto *CS = dyn_cast<llvm::ConstantStruct>(Op.get());
@@ -204,28 +252,497 @@ static std::vector<std::string> getAnnotationsForValue(const llvm::Module &M, co
             continue;
 
         // struct обычно вида: { i8* (ptr to annotated), i8* (ptr to annotation string), i8* file, i32 line, ... }
-        const llvm::Value *Annotated = CS->getOperand(0)->stripPointerCasts();
-        const llvm::Value *AnnStrPtr = CS->getOperand(1);
+        const auto *Annotated = dyn_cast<llvm::Function>(CS->getOperand(0)->stripPointerCasts());
+        if (!Annotated)
+            continue;
+
+        std::string S = getCStringFromGlobal(CS->getOperand(1));
+        StackCheckAnnotation Ann{StackCheckAnnotation::Size, 0, S};
+        if (S.starts_with(stack_check_size + "=")) {
+            const char *begin = S.data() + stack_check_size.size() + 1;
+            std::from_chars(begin, S.data() + S.size(), Ann.size);
+            if (!Ann.size) {
+                Ann.kind = StackCheckAnnotation::Frame;
+                Ann.func = Annotated;
+            }
+        } else if (S.starts_with(stack_check_limit + "=")) {
+            Ann.kind = StackCheckAnnotation::Limit;
+        } else {
+            continue;
+        }
+        Index[Annotated].push_back(std::move(Ann));
+    }
+
+    return Index;
+}
+
+/*
+ * The name of a function matched by the masks: the demangled name without the return type,
+ * which precedes the qualified name of template functions (`int ns::f<int>(int)` is matched as `ns::f<int>(int)`).
+ */
+
+static std::string getMaskName(const std::string &Mangled) {
+    std::string Name = llvm::demangle(Mangled);
+
+    llvm::ItaniumPartialDemangler Demangler;
+    if (Demangler.partialDemangle(Mangled.c_str()) || !Demangler.isFunction()) {
+        return Name;
+    }
+    char *Return = Demangler.getFunctionReturnType(nullptr, nullptr);
+    if (Return && *Return) {
+        const std::string Prefix = std::string(Return) + " ";
+        if (Name.starts_with(Prefix)) {
+            Name.erase(0, Prefix.size());
+        } else {
+            // The return type is written around the name (e.g. a function pointer), the qualifiers of the method are omitted
+            char *Function = Demangler.getFunctionName(nullptr, nullptr);
+            char *Params = Demangler.getFunctionParameters(nullptr, nullptr);
+            if (Function && Params) {
+                Name = std::string(Function) + Params;
+            }
+            std::free(Function);
+            std::free(Params);
+        }
+    }
+    std::free(Return);
+    return Name;
+}
+
+/*
+ * The `include=<mask>` and `exclude=<mask>` plugin arguments select the protected functions by the glob mask
+ * of the demangled name without the return type (for example, `parser::*`). A function matched by an include mask and not annotated
+ * is checked with the limit check, since its frame size is unknown, and the checks of a function matched by an exclude mask
+ * are removed, including the checks of its attributes. The names are matched once per function of the module,
+ * so the calls only look up the callee in the index. Returns the excluded functions.
+ */
+
+static llvm::DenseSet<const llvm::Function *> applyNameMasks(const llvm::Module &M, AnnotationIndex &Index) {
+    llvm::DenseSet<const llvm::Function *> Excluded;
+    if (include_masks.empty() && exclude_masks.empty()) {
+        return Excluded;
+    }
+
+    auto Match = [](const std::vector<std::pair<std::string, llvm::GlobPattern>> &Masks, llvm::StringRef Name) -> const std::string * {
+        for (const auto &Mask : Masks) {
+            if (Mask.second.match(Name)) {
+                return &Mask.first;
+            }
+        }
+        return nullptr;
+    };
+
+    for (const llvm::Function &F : M) {
+        // The intrinsics and the runtime functions of the checks are never protected
+        if (F.isIntrinsic() || F.getName().starts_with("_ZN5trust")) {
+            continue;
+        }
+        const std::string Name = getMaskName(F.getName().str());
+
+        if (const std::string *Mask = Match(exclude_masks, Name)) {
+            Index.erase(&F);
+            Excluded.insert(&F);
+            Verbose(SourceLocation(), std::format("Exclude {} by the mask '{}'", Name, *Mask));
+        } else if (const std::string *Mask = Match(include_masks, Name); Mask && !Index.count(&F)) {
+            Index[&F].push_back({StackCheckAnnotation::Limit, 0, "include=" + *Mask});
+            Verbose(SourceLocation(), std::format("Protect {} by the mask '{}'", Name, *Mask));
+        }
+    }
+    return Excluded;
+}
+
+/*
+ * The possible targets of an indirect call are approximated by the annotated functions of the module with the type of the call.
+ * A call through a function pointer can reach the annotated functions whose address is taken outside of vtables.
+ * A virtual call loads the callee from a slot of the vtable at a constant offset from its address point, so it can reach
+ * only the functions (or the targets of the thunks) placed in the vtables of the module at the same offset. The class of the call
+ * is not known in the IR, so the slots of the same offset in the vtables of unrelated classes are also taken into account,
+ * and a call through a member function pointer (a slot with a variable offset) can reach any function in the vtables.
+ * A virtual call is not matched with the functions whose address is taken outside of vtables, even of the same type.
+ * The checks of all such targets are merged into the worst case: the maximum size and a limit check if any of the targets
+ * requires it. The automatic frame sizes are known only at runtime, so the frame of each such target is checked separately.
+ */
+
+typedef llvm::SmallVector<StackCheckAnnotation, 2> MergedChecks;
+
+struct IndirectIndex {
+    // The functions whose address is taken outside of vtables, by the type
+    llvm::DenseMap<const llvm::FunctionType *, MergedChecks> Pointer;
+    // The functions placed in vtables, by the type and the offset of the slot from the address point
+    llvm::DenseMap<std::pair<const llvm::FunctionType *, int64_t>, MergedChecks> Slot;
+    // The functions placed in vtables, by the type (for the slots with a variable offset)
+    llvm::DenseMap<const llvm::FunctionType *, MergedChecks> AnySlot;
+};
+
+static void mergeChecks(MergedChecks &Merged, llvm::ArrayRef<StackCheckAnnotation> Anns) {
+    for (const StackCheckAnnotation &Ann : Anns) {
+        auto Same = llvm::find_if(Merged, [&](const StackCheckAnnotation &Other) { return Other.kind == Ann.kind && Other.func == Ann.func; });
+        if (Same == Merged.end()) {
+            Merged.push_back(Ann);
+        } else if (Same->size < Ann.size) {
+            *Same = Ann;
+        }
+    }
+}
+
+// The order of the DenseMap is not stable, so the checks are sorted by kind and by the name of the function
+static void sortChecks(MergedChecks &Merged) {
+    llvm::sort(Merged, [](const StackCheckAnnotation &L, const StackCheckAnnotation &R) {
+        if (L.kind != R.kind) {
+            return L.kind < R.kind;
+        }
+        return L.func && R.func && L.func->getName() < R.func->getName();
+    });
+}
+
+static bool isVtable(const llvm::GlobalVariable &GV) { return GV.getName().starts_with("_ZTV") || GV.getName().starts_with("_ZTC"); }
+
+// The use in a vtable, i.e. in an array of the initializer of a vtable
+static bool isVtableUse(const llvm::User *User) {
+    if (!isa<llvm::ConstantArray>(User)) {
+        return false;
+    }
+    for (const llvm::User *Outer : User->users()) {
+        if (auto *GV = dyn_cast<llvm::GlobalVariable>(Outer); GV && isVtable(*GV)) {
+            return true;
+        }
+        if (isa<llvm::ConstantStruct>(Outer)) {
+            for (const llvm::User *Global : Outer->users()) {
+                if (auto *GV = dyn_cast<llvm::GlobalVariable>(Global); GV && isVtable(*GV)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static bool isAddressTaken(const llvm::Function &F, const llvm::Constant *Annotations) {
+    for (const llvm::Use &U : F.uses()) {
+        const llvm::User *User = U.getUser();
+        if (auto *Call = dyn_cast<llvm::CallBase>(User); Call && Call->isCallee(&U)) {
+            continue;
+        }
+        // The reference from llvm.global.annotations does not make the function callable through a pointer
+        if (Annotations && isa<llvm::ConstantStruct>(User) && llvm::is_contained(User->users(), Annotations)) {
+            continue;
+        }
+        // The references from vtables are the targets of virtual calls
+        if (isVtableUse(User)) {
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+// The annotated function called by a thunk of the vtable (the adjustment of `this` for a secondary base)
+static const llvm::Function *getThunkTarget(const llvm::Function &Thunk, const AnnotationIndex &Index) {
+    llvm::StringRef Name = Thunk.getName();
+    if (Thunk.isDeclaration() || !(Name.starts_with("_ZTh") || Name.starts_with("_ZTv") || Name.starts_with("_ZTc"))) {
+        return nullptr;
+    }
+    for (const llvm::Instruction &Inst : llvm::instructions(Thunk)) {
+        if (auto *Call = dyn_cast<llvm::CallBase>(&Inst)) {
+            if (const llvm::Function *Callee = Call->getCalledFunction(); Callee && Index.count(Callee)) {
+                return Callee;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static IndirectIndex buildIndirectIndex(const llvm::Module &M, const AnnotationIndex &Index) {
+    IndirectIndex Indirect;
+    if (Index.empty()) {
+        return Indirect;
+    }
+
+    const llvm::GlobalVariable *GA = M.getNamedGlobal("llvm.global.annotations");
+    for (const auto &[Annotated, Anns] : Index) {
+        if (isAddressTaken(*Annotated, GA && GA->hasInitializer() ? GA->getInitializer() : nullptr)) {
+            mergeChecks(Indirect.Pointer[Annotated->getFunctionType()], Anns);
+        }
+    }
+
+    // The slots of each vtable of a group start after its address point, i.e. after the offset to top and the RTTI,
+    // and all entries in the slots are functions (including __cxa_pure_virtual and the thunks)
+    const int64_t PointerSize = M.getDataLayout().getPointerSize();
+    for (const llvm::GlobalVariable &GV : M.globals()) {
+        if (!isVtable(GV) || !GV.hasInitializer()) {
+            continue;
+        }
+        llvm::SmallVector<const llvm::ConstantArray *, 2> Arrays;
+        if (auto *Array = dyn_cast<llvm::ConstantArray>(GV.getInitializer())) {
+            Arrays.push_back(Array);
+        } else if (auto *Group = dyn_cast<llvm::ConstantStruct>(GV.getInitializer())) {
+            for (const llvm::Use &Op : Group->operands()) {
+                if (auto *Array = dyn_cast<llvm::ConstantArray>(Op.get())) {
+                    Arrays.push_back(Array);
+                }
+            }
+        }
+
+        for (const llvm::ConstantArray *Array : Arrays) {
+            int64_t AddressPoint = -1;
+            for (unsigned I = 0; I < Array->getNumOperands(); I++) {
+                const auto *Entry = dyn_cast<llvm::Function>(Array->getOperand(I)->stripPointerCasts());
+                if (!Entry) {
+                    AddressPoint = I + 1;
+                    continue;
+                }
+                if (AddressPoint < 0) {
+                    continue;
+                }
+                const llvm::Function *Target = Index.count(Entry) ? Entry : getThunkTarget(*Entry, Index);
+                if (!Target) {
+                    continue;
+                }
+                const llvm::SmallVector<StackCheckAnnotation, 1> &Anns = Index.find(Target)->second;
+                mergeChecks(Indirect.Slot[{Target->getFunctionType(), (I - AddressPoint) * PointerSize}], Anns);
+                mergeChecks(Indirect.AnySlot[Target->getFunctionType()], Anns);
+            }
+        }
+    }
+
+    for (auto &[Type, Merged] : Indirect.Pointer) {
+        sortChecks(Merged);
+    }
+    for (auto &[Slot, Merged] : Indirect.Slot) {
+        sortChecks(Merged);
+    }
+    for (auto &[Type, Merged] : Indirect.AnySlot) {
+        sortChecks(Merged);
+    }
+    return Indirect;
+}
+
+/*
+ * The vtable slots from which the callee of an indirect call may be loaded: a load from a constant offset
+ * of a loaded vtable pointer, or from a variable offset (a member function pointer). The vtable pointer is recognized
+ * by the TBAA access type "vtable pointer" of clang when optimizing. Without TBAA (at -O0) any loaded pointer
+ * that is indexed as an array of pointers is taken for a vtable pointer, so a function pointer loaded in this way
+ * from an array through a pointer is matched only with the functions of the vtables. A callee from any other source
+ * (a local variable, a field of a structure, a global table, the non-virtual branch of a member function pointer)
+ * is matched with the functions whose address is taken. The values of PHI nodes and selects are traced.
+ */
+
+struct CalleeSlots {
+    llvm::SmallVector<int64_t, 2> Offsets;
+    bool AnySlot = false;
+    // The callee may be loaded from a place other than a vtable
+    bool Pointer = false;
+};
+
+static bool isVtableLoad(const llvm::Value *Base) {
+    auto *Load = dyn_cast<llvm::LoadInst>(Base);
+    if (!Load) {
+        return false;
+    }
+    const llvm::MDNode *Tag = Load->getMetadata(llvm::LLVMContext::MD_tbaa);
+    if (!Tag) {
+        return true;
+    }
+    const auto *Type = Tag->getNumOperands() ? dyn_cast<llvm::MDNode>(Tag->getOperand(0)) : nullptr;
+    const auto *Name = Type && Type->getNumOperands() ? dyn_cast<llvm::MDString>(Type->getOperand(0)) : nullptr;
+    return Name && Name->getString() == "vtable pointer";
+}
+
+static void findCalleeSlots(const llvm::Value *Callee, const llvm::DataLayout &DL, CalleeSlots &Slots,
+                            llvm::SmallPtrSetImpl<const llvm::Value *> &Visited) {
+    Callee = Callee->stripPointerCasts();
+    if (!Visited.insert(Callee).second) {
+        return;
+    }
+    if (auto *Phi = dyn_cast<llvm::PHINode>(Callee)) {
+        for (const llvm::Value *Incoming : Phi->incoming_values()) {
+            findCalleeSlots(Incoming, DL, Slots, Visited);
+        }
+        return;
+    }
+    if (auto *Select = dyn_cast<llvm::SelectInst>(Callee)) {
+        findCalleeSlots(Select->getTrueValue(), DL, Slots, Visited);
+        findCalleeSlots(Select->getFalseValue(), DL, Slots, Visited);
+        return;
+    }
+
+    auto *Load = dyn_cast<llvm::LoadInst>(Callee);
+    if (!Load) {
+        Slots.Pointer = true;
+        return;
+    }
+    const llvm::Value *Slot = Load->getPointerOperand()->stripPointerCasts();
+    auto *GEP = dyn_cast<llvm::GEPOperator>(Slot);
+    const llvm::Value *Base = GEP ? GEP->getPointerOperand() : Slot;
+    if ((GEP && GEP->getSourceElementType()->isAggregateType()) || !isVtableLoad(Base->stripPointerCastsForAliasAnalysis())) {
+        Slots.Pointer = true;
+        return;
+    }
+
+    llvm::APInt Offset(DL.getIndexTypeSizeInBits(Slot->getType()), 0);
+    if (GEP && !GEP->accumulateConstantOffset(DL, Offset)) {
+        Slots.AnySlot = true;
+        return;
+    }
+    Slots.Offsets.push_back(Offset.getSExtValue());
+}
 
-        if (Annotated == Target) {
-            std::string S = getCStringFromGlobal(AnnStrPtr);
-            if (!S.empty())
-                Out.push_back(S);
+// The worst-case checks of an indirect call, the result is empty if the call cannot reach any annotated function
+static MergedChecks getIndirectChecks(const IndirectIndex &Indirect, const llvm::CallBase &Call, const llvm::DataLayout &DL) {
+    CalleeSlots Slots;
+    llvm::SmallPtrSet<const llvm::Value *, 8> Visited;
+    findCalleeSlots(Call.getCalledOperand(), DL, Slots, Visited);
+
+    MergedChecks Merged;
+    const llvm::FunctionType *Type = Call.getFunctionType();
+    if (Slots.Pointer) {
+        if (auto Found = Indirect.Pointer.find(Type); Found != Indirect.Pointer.end()) {
+            mergeChecks(Merged, Found->second);
         }
     }
+    if (Slots.AnySlot) {
+        if (auto Found = Indirect.AnySlot.find(Type); Found != Indirect.AnySlot.end()) {
+            mergeChecks(Merged, Found->second);
+        }
+    } else {
+        for (int64_t Offset : Slots.Offsets) {
+            if (auto Found = Indirect.Slot.find({Type, Offset}); Found != Indirect.Slot.end()) {
+                mergeChecks(Merged, Found->second);
+            }
+        }
+    }
+    sortChecks(Merged);
+    return Merged;
+}
+
+/*
+ * With the `recursion` plugin argument, the calls that close the cycles of recursion are checked without attributes.
+ * The strongly connected components of the call graph of the module are the sets of mutually recursive functions,
+ * and a depth-first search inside each component finds its back edges. Every cycle contains at least one back edge,
+ * so a check on each of them is executed on each round of the recursion, and the other calls are not checked.
+ */
+
+static llvm::DenseSet<const llvm::CallBase *> findRecursiveCalls(llvm::Module &M) {
+    llvm::DenseSet<const llvm::CallBase *> BackEdges;
+
+    // The search starts from the first function of a component in the module order, so the result is stable
+    llvm::DenseMap<const llvm::Function *, unsigned> Order;
+    for (const llvm::Function &F : M) {
+        Order[&F] = Order.size();
+    }
 
-    return Out;
+    llvm::CallGraph CG(M);
+    for (llvm::scc_iterator<llvm::CallGraph *> SCC = llvm::scc_begin(&CG); !SCC.isAtEnd(); ++SCC) {
+        if (!SCC.hasCycle()) {
+            continue;
+        }
+
+        llvm::SmallPtrSet<const llvm::Function *, 8> Members;
+        const llvm::Function *Root = nullptr;
+        for (const llvm::CallGraphNode *Node : *SCC) {
+            if (const llvm::Function *F = Node->getFunction()) {
+                Members.insert(F);
+                if (!Root || Order.lookup(F) < Order.lookup(Root)) {
+                    Root = F;
+                }
+            }
+        }
+        if (!Root) {
+            continue;
+        }
+
+        // The direct calls of the function to the other functions of the component
+        auto Calls = [&Members](const llvm::Function *F) {
+            llvm::SmallVector<const llvm::CallBase *, 4> Result;
+            for (const llvm::Instruction &Inst : llvm::instructions(F)) {
+                if (auto *Call = dyn_cast<llvm::CallBase>(&Inst)) {
+                    if (const llvm::Function *Callee = Call->getCalledFunction(); Callee && Members.contains(Callee)) {
+                        Result.push_back(Call);
+                    }
+                }
+            }
+            return Result;
+        };
+
+        // A call of a function that is still on the search stack is a back edge
+        llvm::SmallPtrSet<const llvm::Function *, 8> Visited;
+        llvm::SmallPtrSet<const llvm::Function *, 8> Active;
+        struct Frame {
+            const llvm::Function *F;
+            llvm::SmallVector<const llvm::CallBase *, 4> Edges;
+            size_t Next;
+        };
+        llvm::SmallVector<Frame, 8> Stack;
+        Visited.insert(Root);
+        Active.insert(Root);
+        Stack.push_back({Root, Calls(Root), 0});
+        size_t Count = 0;
+        while (!Stack.empty()) {
+            Frame &Top = Stack.back();
+            if (Top.Next == Top.Edges.size()) {
+                Active.erase(Top.F);
+                Stack.pop_back();
+                continue;
+            }
+            const llvm::CallBase *Call = Top.Edges[Top.Next++];
+            const llvm::Function *Callee = Call->getCalledFunction();
+            if (Active.contains(Callee)) {
+                BackEdges.insert(Call);
+                Count++;
+            } else if (Visited.insert(Callee).second) {
+                Active.insert(Callee);
+                Stack.push_back({Callee, Calls(Callee), 0});
+            }
+        }
+
+        Verbose(SourceLocation(), std::format("Recursive cycle of {} functions from {}: checks on {} back edges", Members.size(),
+                                              Root->getName().str(), Count));
+    }
+    return BackEdges;
 }
 
 class DebugInjectorPass : public llvm::PassInfoMixin<DebugInjectorPass> {
   public:
+    explicit DebugInjectorPass(bool optimize = false) : Optimize(optimize) {}
+
     llvm::PreservedAnalyses run(llvm::Module &Module, llvm::ModuleAnalysisManager &);
 
     static bool isRequired() { return true; }
 
   private:
+    // Check injected before the call of an annotated function
+    struct InjectedCheck {
+        llvm::CallInst *Call;
+        StackCheckAnnotation::Kind Kind;
+        size_t Size;
+        // The frame size record of the callee for the Frame kind
+        llvm::GlobalVariable *Frame = nullptr;
+    };
+
+    // Hoisting and merging of the injected checks (only when optimizing)
+    bool Optimize;
+
+    void OptimizeChecks(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks);
+    // The calls of the injected checks are not counted as the calls that may throw or not return
+    size_t HoistChecks(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks, const llvm::DominatorTree &DT,
+                       const llvm::LoopInfo &LI, const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected);
+    size_t CoalesceChecks(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks, llvm::DominatorTree &DT,
+                          const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected);
+    size_t PlaceChecksByProfile(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks, const llvm::DominatorTree &DT,
+                                const llvm::LoopInfo &LI, const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected);
+
+    void ExpandCheck(llvm::Module &Module, llvm::GlobalVariable &Info, const InjectedCheck &Check);
+
     llvm::Function *FuncCheckSize(llvm::Module &Module);
     llvm::Function *FuncCheckLimit(llvm::Module &Module);
+    llvm::Function *FuncCheckSizeSite(llvm::Module &Module);
+    llvm::Function *FuncCheckLimitSite(llvm::Module &Module);
+    llvm::Function *FuncCheckSizeFailed(llvm::Module &Module);
+    llvm::Function *FuncCheckLimitFailed(llvm::Module &Module);
+    llvm::Function *FuncCheckFrame(llvm::Module &Module);
+    llvm::Function *FuncCheckFrameSite(llvm::Module &Module);
+    llvm::Function *FuncCheckFrameFailed(llvm::Module &Module);
+    llvm::GlobalVariable *CreateSite(llvm::Module &Module, llvm::Instruction &Inst, llvm::StringRef Callee);
+    llvm::GlobalVariable *GetFrame(llvm::Module &Module, const llvm::Function &Callee);
 };
 
 llvm::Function *DebugInjectorPass::FuncCheckSize(llvm::Module &Module) {
@@ -253,17 +770,544 @@ llvm::Function *DebugInjectorPass::FuncCheckLimit(llvm::Module &Module) {
     return llvm::cast<llvm::Function>(Callee.getCallee());
 }
 
+/*
+ * With the `counters` plugin argument, instrumented checks are injected, which also update
+ * the counters of the call site (the trust::stack_check_site structure in the `stack_check_sites` section).
+ */
+
+llvm::Function *DebugInjectorPass::FuncCheckSizeSite(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::FunctionType *check_overflow_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(Context), {llvm::Type::getInt64Ty(Context), llvm::PointerType::getUnqual(Context)}, false);
+    llvm::FunctionCallee Callee =
+        Module.getOrInsertFunction("_ZN5trust11stack_check19check_overflow_siteEmPNS_16stack_check_siteE", check_overflow_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+llvm::Function *DebugInjectorPass::FuncCheckLimitSite(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::FunctionType *check_limit_type =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(Context), {llvm::PointerType::getUnqual(Context)}, false);
+    llvm::FunctionCallee Callee = Module.getOrInsertFunction("_ZN5trust11stack_check16check_limit_siteEPNS_16stack_check_siteE", check_limit_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+/*
+ * The slow paths of the checks, which are called from the checks expanded inline by the plugin.
+ */
+
+llvm::Function *DebugInjectorPass::FuncCheckSizeFailed(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::FunctionType *failed_type = llvm::FunctionType::get(llvm::Type::getVoidTy(Context), llvm::Type::getInt64Ty(Context), false);
+    llvm::FunctionCallee Callee = Module.getOrInsertFunction("_ZN5trust11stack_check21check_overflow_failedEm", failed_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+llvm::Function *DebugInjectorPass::FuncCheckLimitFailed(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::FunctionType *failed_type = llvm::FunctionType::get(llvm::Type::getVoidTy(Context), false);
+    llvm::FunctionCallee Callee = Module.getOrInsertFunction("_ZN5trust11stack_check18check_limit_failedEv", failed_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+/*
+ * For the functions annotated with `STACK_CHECK_SIZE(0)`, the checks take the frame size from the trust::stack_check_frame
+ * record of the callee, which is resolved from the `.stack_sizes` section on the first check.
+ */
+
+llvm::Function *DebugInjectorPass::FuncCheckFrame(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::FunctionType *check_frame_type =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(Context), {llvm::PointerType::getUnqual(Context)}, false);
+    llvm::FunctionCallee Callee =
+        Module.getOrInsertFunction("_ZN5trust11stack_check20check_overflow_frameEPNS_17stack_check_frameE", check_frame_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+llvm::Function *DebugInjectorPass::FuncCheckFrameSite(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::PointerType *Ptr = llvm::PointerType::getUnqual(Context);
+    llvm::FunctionType *check_frame_type = llvm::FunctionType::get(llvm::Type::getVoidTy(Context), {Ptr, Ptr}, false);
+    llvm::FunctionCallee Callee = Module.getOrInsertFunction(
+        "_ZN5trust11stack_check25check_overflow_frame_siteEPNS_17stack_check_frameEPNS_16stack_check_siteE", check_frame_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+llvm::Function *DebugInjectorPass::FuncCheckFrameFailed(llvm::Module &Module) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::FunctionType *failed_type = llvm::FunctionType::get(llvm::Type::getVoidTy(Context), {llvm::PointerType::getUnqual(Context)}, false);
+    llvm::FunctionCallee Callee =
+        Module.getOrInsertFunction("_ZN5trust11stack_check18check_frame_failedEPNS_17stack_check_frameE", failed_type);
+    return llvm::cast<llvm::Function>(Callee.getCallee());
+}
+
+// One record per callee in the module, shared by all its checks
+llvm::GlobalVariable *DebugInjectorPass::GetFrame(llvm::Module &Module, const llvm::Function &Callee) {
+    std::string name = "__stack_check_frame." + Callee.getName().str();
+    if (llvm::GlobalVariable *Frame = Module.getNamedGlobal(name)) {
+        return Frame;
+    }
+
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::Type *Int64 = llvm::Type::getInt64Ty(Context);
+
+    // struct trust::stack_check_frame { const void *func; uint64_t size; }, the size is trust::stack_check_frame::unresolved
+    llvm::StructType *FrameType = llvm::StructType::get(Context, {llvm::PointerType::getUnqual(Context), Int64});
+    llvm::Constant *Init = llvm::ConstantStruct::get(
+        FrameType, {const_cast<llvm::Function *>(&Callee), llvm::ConstantInt::get(Int64, UINT64_MAX / 4)});
+
+    auto *Frame = new llvm::GlobalVariable(Module, FrameType, false, llvm::GlobalValue::InternalLinkage, Init, name);
+    Frame->setAlignment(llvm::Align(8));
+
+    Verbose(SourceLocation(), std::format("Create the frame size record of {}", Callee.getName().str()));
+    return Frame;
+}
+
+llvm::GlobalVariable *DebugInjectorPass::CreateSite(llvm::Module &Module, llvm::Instruction &Inst, llvm::StringRef Callee) {
+    llvm::LLVMContext &Context = Module.getContext();
+    llvm::Type *Int64 = llvm::Type::getInt64Ty(Context);
+    llvm::PointerType *Ptr = llvm::PointerType::getUnqual(Context);
+
+    // The file and line are taken from the debug info of the call or the function (-g or -gline-tables-only)
+    std::string file = Module.getSourceFileName();
+    uint64_t line = 0;
+    if (const llvm::DebugLoc &Loc = Inst.getDebugLoc()) {
+        file = Loc->getFilename().str();
+        line = Loc->getLine();
+    } else if (llvm::DISubprogram *SP = Inst.getFunction()->getSubprogram()) {
+        file = SP->getFilename().str();
+        line = SP->getLine();
+    }
+
+    auto CreateString = [&](llvm::StringRef str) -> llvm::Constant * {
+        llvm::Constant *data = llvm::ConstantDataArray::getString(Context, str);
+        auto *GV = new llvm::GlobalVariable(Module, data->getType(), true, llvm::GlobalValue::PrivateLinkage, data, ".stack_check_str");
+        GV->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        GV->setAlignment(llvm::Align(1));
+        return GV;
+    };
+
+    // struct trust::stack_check_site { uint64_t count; uint64_t min_free; const char *file; const char *callee; uint64_t line; }
+    llvm::StructType *SiteType = llvm::StructType::get(Context, {Int64, Int64, Ptr, Ptr, Int64});
+    llvm::Constant *Init = llvm::ConstantStruct::get(SiteType, {llvm::ConstantInt::get(Int64, 0), llvm::ConstantInt::get(Int64, UINT64_MAX),
+                                                                CreateString(file), CreateString(Callee),
+                                                                llvm::ConstantInt::get(Int64, line)});
+
+    auto *Site = new llvm::GlobalVariable(Module, SiteType, false, llvm::GlobalValue::InternalLinkage, Init, "__stack_check_site");
+    Site->setSection("stack_check_sites");
+    Site->setAlignment(llvm::Align(8));
+    llvm::appendToCompilerUsed(Module, {Site});
+
+    Verbose(SourceLocation(), std::format("Create the counters of the call site {}:{} for {}", file, line, Callee.str()));
+    return Site;
+}
+
+/*
+ * A check is moved to an earlier position only if it is executed there on the way to the guarded call,
+ * and the calls in between return normally. Otherwise the moved check could throw `stack_overflow`
+ * instead of the exception of such a call, after `longjmp` or `exit`, or on a path that never reaches the guarded call.
+ */
+
+// A call that always returns normally: marked `nounwind` and `willreturn`, or a call of a leaf function without loops
+static bool isReturningCall(const llvm::CallBase &Call) {
+    if (Call.doesNotThrow() && Call.willReturn()) {
+        return true;
+    }
+    const llvm::Function *Callee = Call.getCalledFunction();
+    if (!Callee || Callee->isDeclaration() || !Callee->isDefinitionExact()) {
+        return false;
+    }
+    for (const llvm::Instruction &Inst : llvm::instructions(Callee)) {
+        if (auto *Inner = dyn_cast<llvm::CallBase>(&Inst); Inner && !(Inner->doesNotThrow() && Inner->willReturn())) {
+            return false;
+        }
+        if (isa<llvm::ResumeInst>(&Inst)) {
+            return false;
+        }
+    }
+    llvm::SmallVector<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>, 4> BackEdges;
+    llvm::FindFunctionBackedges(*Callee, BackEdges);
+    return BackEdges.empty();
+}
+
+// All calls on the paths from the earlier position of a check to the later one (except the injected checks) return normally
+static bool isReturningPath(const llvm::Instruction *From, const llvm::Instruction *To,
+                            const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected) {
+    auto IsReturning = [&Injected](const llvm::Instruction &Inst) {
+        auto *Call = dyn_cast<llvm::CallBase>(&Inst);
+        return !Call || Injected.contains(Call) || isReturningCall(*Call);
+    };
+    auto IsReturningRange = [&IsReturning](llvm::BasicBlock::const_iterator Begin, llvm::BasicBlock::const_iterator End) {
+        return std::all_of(Begin, End, IsReturning);
+    };
+
+    const llvm::BasicBlock *FromBlock = From->getParent();
+    const llvm::BasicBlock *ToBlock = To->getParent();
+    if (FromBlock == ToBlock) {
+        return IsReturningRange(std::next(From->getIterator()), To->getIterator());
+    }
+    if (!IsReturningRange(std::next(From->getIterator()), FromBlock->end()) || !IsReturningRange(ToBlock->begin(), To->getIterator())) {
+        return false;
+    }
+
+    // The blocks between them (the later position post-dominates the earlier one, so all paths lead to its block)
+    llvm::SmallPtrSet<const llvm::BasicBlock *, 8> Visited;
+    llvm::SmallVector<const llvm::BasicBlock *, 8> Worklist(llvm::successors(FromBlock));
+    while (!Worklist.empty()) {
+        const llvm::BasicBlock *Block = Worklist.pop_back_val();
+        if (Block == ToBlock || !Visited.insert(Block).second) {
+            continue;
+        }
+        if (!IsReturningRange(Block->begin(), Block->end())) {
+            return false;
+        }
+        Worklist.append(llvm::succ_begin(Block), llvm::succ_end(Block));
+    }
+    return true;
+}
+
+/*
+ * The check compares the frame of the function with the bottom of the stack, which does not change
+ * while the function is running. Dynamic allocas move the stack pointer inside the function, and the parts
+ * of a coroutine are executed on different stacks, so the checks of such functions are left in place.
+ */
+
+void DebugInjectorPass::OptimizeChecks(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks) {
+    if (Function.isPresplitCoroutine()) {
+        return;
+    }
+    for (llvm::Instruction &Inst : llvm::instructions(Function)) {
+        if (auto *Alloca = llvm::dyn_cast<llvm::AllocaInst>(&Inst); Alloca && !Alloca->isStaticAlloca()) {
+            return;
+        }
+    }
+
+    llvm::SmallPtrSet<const llvm::Instruction *, 8> Injected;
+    for (const InjectedCheck &Check : Checks) {
+        Injected.insert(Check.Call);
+    }
+
+    llvm::DominatorTree DT(Function);
+    llvm::LoopInfo LI(DT);
+    if (is_hoist) {
+        HoistChecks(Function, Checks, DT, LI, Injected);
+    }
+    if (is_profile) {
+        PlaceChecksByProfile(Function, Checks, DT, LI, Injected);
+    }
+    if (is_coalesce && Checks.size() > 1) {
+        CoalesceChecks(Function, Checks, DT, Injected);
+    }
+}
+
+/*
+ * A check inside a loop is moved to the preheader of the outermost loop in which it is executed
+ * on each iteration before the loop can exit (its block dominates all latches and exiting blocks of the loop),
+ * so it is executed once before the loop. A loop whose header exits before the call (`for` and `while` loops
+ * before the loop rotation, which may run zero times) and a check on a conditional path of the loop body are left in place.
+ */
+
+size_t DebugInjectorPass::HoistChecks(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks, const llvm::DominatorTree &DT,
+                                      const llvm::LoopInfo &LI, const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected) {
+    auto IsExecutedOnEntry = [&DT](const llvm::Loop *L, const llvm::BasicBlock *Block) {
+        llvm::SmallVector<llvm::BasicBlock *, 4> Blocks;
+        L->getLoopLatches(Blocks);
+        L->getExitingBlocks(Blocks);
+        return llvm::all_of(Blocks, [&](const llvm::BasicBlock *Other) { return DT.dominates(Block, Other); });
+    };
+
+    size_t Hoisted = 0;
+    for (InjectedCheck &Check : Checks) {
+        bool IsHoisted = false;
+        for (const llvm::Loop *L = LI.getLoopFor(Check.Call->getParent()); L; L = L->getParentLoop()) {
+            llvm::BasicBlock *Preheader = L->getLoopPreheader();
+            if (!Preheader || !IsExecutedOnEntry(L, Check.Call->getParent()) ||
+                !isReturningPath(Preheader->getTerminator(), Check.Call, Injected)) {
+                break;
+            }
+            Check.Call->moveBefore(Preheader->getTerminator()->getIterator());
+            IsHoisted = true;
+        }
+        Hoisted += IsHoisted;
+    }
+
+    if (Hoisted) {
+        Verbose(SourceLocation(), std::format("Hoisted {} of {} stack checks out of loops in {}", Hoisted, Checks.size(), Function.getName().str()));
+
+        llvm::OptimizationRemarkEmitter ORE(&Function);
+        ORE.emit([&]() {
+            return llvm::OptimizationRemark("stack-check", "HoistedChecks", &Function)
+                   << "hoisted " << llvm::ore::NV("Hoisted", static_cast<unsigned>(Hoisted)) << " of "
+                   << llvm::ore::NV("Checks", static_cast<unsigned>(Checks.size())) << " stack checks out of loops";
+        });
+    }
+    return Hoisted;
+}
+
+/*
+ * With the `profile` plugin argument and the profile data of the function (-fprofile-instr-use), a check is moved
+ * to the coldest block that dominates it, if that block is executed at least twice less often according to the block frequencies.
+ * The block of the check must post-dominate the new one and the calls in between must return normally, so the moved check
+ * is executed only on the paths to the call. So a check in a loop that is not hoisted by HoistChecks (with `no-hoist`
+ * or without a dedicated preheader) goes to a block before the loop. A check on a conditional path, including a hot one,
+ * and a check on a path that is never executed in the profile are left in place.
+ */
+
+size_t DebugInjectorPass::PlaceChecksByProfile(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks,
+                                               const llvm::DominatorTree &DT, const llvm::LoopInfo &LI,
+                                               const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected) {
+    if (!Function.getEntryCount()) {
+        return 0;
+    }
+    llvm::BranchProbabilityInfo BPI(Function, LI);
+    llvm::BlockFrequencyInfo BFI(Function, BPI, LI);
+    llvm::PostDominatorTree PDT(Function);
+
+    size_t Moved = 0;
+    for (InjectedCheck &Check : Checks) {
+        const llvm::DomTreeNode *Node = DT.getNode(Check.Call->getParent());
+        if (!Node) {
+            continue;
+        }
+        const uint64_t Frequency = BFI.getBlockFreq(Node->getBlock()).getFrequency();
+        uint64_t Coldest = Frequency;
+        llvm::BasicBlock *Target = nullptr;
+        for (Node = Node->getIDom(); Node; Node = Node->getIDom()) {
+            if (!PDT.dominates(Check.Call->getParent(), Node->getBlock())) {
+                continue;
+            }
+            const uint64_t Dominator = BFI.getBlockFreq(Node->getBlock()).getFrequency();
+            if (Dominator < Coldest && isReturningPath(Node->getBlock()->getTerminator(), Check.Call, Injected)) {
+                Coldest = Dominator;
+                Target = Node->getBlock();
+            }
+        }
+        if (Target && Coldest <= Frequency / 2) {
+            Check.Call->moveBefore(Target->getTerminator()->getIterator());
+            Moved++;
+        }
+    }
+
+    if (Moved) {
+        Verbose(SourceLocation(), std::format("Moved {} of {} stack checks to colder blocks in {}", Moved, Checks.size(), Function.getName().str()));
+
+        llvm::OptimizationRemarkEmitter ORE(&Function);
+        ORE.emit([&]() {
+            return llvm::OptimizationRemark("stack-check", "PlacedChecks", &Function)
+                   << "moved " << llvm::ore::NV("Moved", static_cast<unsigned>(Moved)) << " of "
+                   << llvm::ore::NV("Checks", static_cast<unsigned>(Checks.size())) << " stack checks to colder blocks by the profile";
+        });
+    }
+    return Moved;
+}
+
+/*
+ * Within one function, a check that is always executed earlier (dominates) with at least the same size
+ * makes the later one redundant. A later check with a larger size is merged into the earlier one, if it is always
+ * executed after it (post-dominates), otherwise the earlier check would throw on a path that does not need that much stack.
+ * The merged check is also not moved over a call that may throw or not return, since then it could throw `stack_overflow`
+ * instead of the exception of that call, or on a path that never reaches the later check.
+ */
+
+size_t DebugInjectorPass::CoalesceChecks(llvm::Function &Function, llvm::SmallVectorImpl<InjectedCheck> &Checks, llvm::DominatorTree &DT,
+                                         const llvm::SmallPtrSetImpl<const llvm::Instruction *> &Injected) {
+    llvm::PostDominatorTree PDT(Function);
+    DT.updateDFSNumbers();
+
+    // The dominating checks are processed before the checks they dominate (unreachable blocks go last)
+    auto Order = [&DT](const llvm::BasicBlock *Block) {
+        const llvm::DomTreeNode *Node = DT.getNode(Block);
+        return Node ? Node->getDFSNumIn() : UINT_MAX;
+    };
+    llvm::stable_sort(Checks, [&Order](const InjectedCheck &A, const InjectedCheck &B) {
+        if (A.Call->getParent() == B.Call->getParent()) {
+            return A.Call->comesBefore(B.Call);
+        }
+        return std::make_pair(Order(A.Call->getParent()), A.Call->getParent()) <
+               std::make_pair(Order(B.Call->getParent()), B.Call->getParent());
+    });
+
+    llvm::SmallVector<InjectedCheck *, 8> Kept;
+    llvm::SmallVector<llvm::CallInst *, 8> Elided;
+    for (InjectedCheck &Check : Checks) {
+        InjectedCheck *Merge = nullptr;
+        bool Redundant = false;
+        for (InjectedCheck *Prev : Kept) {
+            if (Prev->Kind != Check.Kind || !DT.dominates(Prev->Call, Check.Call)) {
+                continue;
+            }
+            if (Check.Kind == StackCheckAnnotation::Limit || (Check.Kind == StackCheckAnnotation::Size && Prev->Size >= Check.Size)) {
+                Redundant = true;
+                break;
+            }
+            // The automatic frame sizes are not known at compile time, only the checks of the same callee are merged
+            if (Check.Kind == StackCheckAnnotation::Frame) {
+                if (Prev->Frame == Check.Frame) {
+                    Redundant = true;
+                    break;
+                }
+                continue;
+            }
+            if (!Merge && PDT.dominates(Check.Call, Prev->Call) && isReturningPath(Prev->Call, Check.Call, Injected)) {
+                Merge = Prev;
+            }
+        }
+
+        if (!Redundant && Merge) {
+            Merge->Size = Check.Size;
+            Merge->Call->setArgOperand(0, llvm::ConstantInt::get(Merge->Call->getArgOperand(0)->getType(), Check.Size));
+            Redundant = true;
+        }
+
+        if (Redundant) {
+            Elided.push_back(Check.Call);
+        } else {
+            Kept.push_back(&Check);
+        }
+    }
+
+    // Only the remaining checks are left in the list
+    const size_t Total = Checks.size();
+    llvm::erase_if(Checks, [&Elided](const InjectedCheck &Check) { return llvm::is_contained(Elided, Check.Call); });
+    for (llvm::CallInst *Call : Elided) {
+        Call->eraseFromParent();
+    }
+
+    if (!Elided.empty()) {
+        Verbose(SourceLocation(), std::format("Elided {} of {} stack checks in {}", Elided.size(), Total, Function.getName().str()));
+
+        llvm::OptimizationRemarkEmitter ORE(&Function);
+        ORE.emit([&]() {
+            return llvm::OptimizationRemark("stack-check", "CoalescedChecks", &Function)
+                   << "elided " << llvm::ore::NV("Elided", static_cast<unsigned>(Elided.size())) << " of "
+                   << llvm::ore::NV("Checks", static_cast<unsigned>(Total)) << " stack checks";
+        });
+    }
+    return Elided.size();
+}
+
+/*
+ * The call of the check function is replaced with its inline code, so the fast path does not depend
+ * on the optimization level and the inliner: the frame address is compared with the lower bound of the stack
+ * from the thread-local variable `trust::stack_check::info`, and the unlikely branch (marked with branch weights,
+ * which is what `__builtin_expect` is lowered to) leads to the call of the slow path, placed at the end of the function.
+ */
+
+void DebugInjectorPass::ExpandCheck(llvm::Module &Module, llvm::GlobalVariable &Info, const InjectedCheck &Check) {
+    llvm::CallInst *Call = Check.Call;
+    llvm::IRBuilder<> Builder(Call);
+    llvm::Type *Int64 = Builder.getInt64Ty();
+
+    llvm::Value *Frame = Builder.CreatePtrToInt(
+        Builder.CreateIntrinsic(llvm::Intrinsic::frameaddress, {Builder.getPtrTy()}, {Builder.getInt32(0)}), Int64);
+    llvm::Value *Address = Builder.CreateThreadLocalAddress(&Info);
+
+    // The fields `bottom` and `bottom_limit` are the first two fields of trust::stack_check
+    llvm::Value *Bound;
+    if (Check.Kind == StackCheckAnnotation::Size) {
+        llvm::Value *Bottom = Builder.CreateLoad(Int64, Address);
+        Bound = Builder.CreateAdd(Bottom, Builder.getInt64(Check.Size));
+    } else if (Check.Kind == StackCheckAnnotation::Frame) {
+        llvm::Value *Bottom = Builder.CreateLoad(Int64, Address);
+        llvm::LoadInst *Size = Builder.CreateLoad(Int64, Builder.CreateStructGEP(Check.Frame->getValueType(), Check.Frame, 1));
+        Size->setAtomic(llvm::AtomicOrdering::Monotonic);
+        Size->setAlignment(llvm::Align(8));
+        Bound = Builder.CreateAdd(Bottom, Size);
+    } else {
+        Bound = Builder.CreateLoad(Int64, Builder.CreateStructGEP(Info.getValueType(), Address, 1));
+    }
+    llvm::Value *Overflow = Builder.CreateICmpULT(Frame, Bound);
+
+    llvm::MDNode *Weights = llvm::MDBuilder(Module.getContext()).createUnlikelyBranchWeights();
+    llvm::Instruction *Cold = llvm::SplitBlockAndInsertIfThen(Overflow, Call->getIterator(), false, Weights);
+
+    Builder.SetInsertPoint(Cold);
+    Builder.SetCurrentDebugLocation(Call->getDebugLoc());
+    if (Check.Kind == StackCheckAnnotation::Size) {
+        Builder.CreateCall(FuncCheckSizeFailed(Module), {Builder.getInt64(Check.Size)});
+    } else if (Check.Kind == StackCheckAnnotation::Frame) {
+        Builder.CreateCall(FuncCheckFrameFailed(Module), {Check.Frame});
+    } else {
+        Builder.CreateCall(FuncCheckLimitFailed(Module));
+    }
+    Cold->getParent()->moveAfter(&Call->getFunction()->back());
+
+    Call->eraseFromParent();
+}
+
 llvm::PreservedAnalyses DebugInjectorPass::run(llvm::Module &Module, llvm::ModuleAnalysisManager &) {
 
     llvm::Function *check_limit = FuncCheckLimit(Module);
     llvm::Function *check_size = FuncCheckSize(Module);
     size_t skip_injection = 0;
 
+    // The annotations are indexed once, and each call only looks up its callee
+    AnnotationIndex Index = buildAnnotationIndex(Module);
+    const llvm::DenseSet<const llvm::Function *> Excluded = applyNameMasks(Module, Index);
+    const IndirectIndex Indirect = buildIndirectIndex(Module, Index);
+
+    // In the recursion mode, the back edges of the call graph are checked with the limit check
+    const llvm::DenseSet<const llvm::CallBase *> RecursiveCalls = is_recursion ? findRecursiveCalls(Module) : llvm::DenseSet<const llvm::CallBase *>();
+    const StackCheckAnnotation RecursionCheck{StackCheckAnnotation::Limit, 0, "recursion"};
+
+    // The checks are expanded inline if the layout of the thread-local stack parameters is known
+    llvm::GlobalVariable *Info = Module.getNamedGlobal("_ZN5trust11stack_check4infoE");
+    const bool Expand = is_inline && Info && Info->isThreadLocal() && Info->getValueType()->isStructTy();
+
     bool Changed = false;
+
+    // Injection of the checks of the annotated function (or of all possible targets of an indirect call) before the instruction
+    auto InjectChecks = [&](llvm::Instruction &Before, const llvm::DebugLoc &Loc, llvm::StringRef Callee,
+                            llvm::ArrayRef<StackCheckAnnotation> Anns, llvm::SmallVectorImpl<InjectedCheck> &Checks) {
+        for (const StackCheckAnnotation &Ann : Anns) {
+            if (skip_injection) {
+                Verbose(SourceLocation(), std::format("Code injection skipped {} for {}", skip_injection, Ann.text));
+                skip_injection--;
+                continue;
+            }
+
+            llvm::IRBuilder<> Builder(&Before);
+            Builder.SetCurrentDebugLocation(Loc);
+            if (Ann.kind == StackCheckAnnotation::Size) {
+                if (is_counters) {
+                    Builder.CreateCall(FuncCheckSizeSite(Module), {Builder.getInt64(Ann.size), CreateSite(Module, Before, Callee)});
+                } else {
+                    Checks.push_back({Builder.CreateCall(check_size, {Builder.getInt64(Ann.size)}), Ann.kind, Ann.size});
+                }
+            } else if (Ann.kind == StackCheckAnnotation::Frame) {
+                llvm::GlobalVariable *Frame = GetFrame(Module, *Ann.func);
+                if (is_counters) {
+                    Builder.CreateCall(FuncCheckFrameSite(Module), {Frame, CreateSite(Module, Before, Callee)});
+                } else {
+                    Checks.push_back({Builder.CreateCall(FuncCheckFrame(Module), {Frame}), Ann.kind, 0, Frame});
+                }
+            } else {
+                if (is_counters) {
+                    Builder.CreateCall(FuncCheckLimitSite(Module), {CreateSite(Module, Before, Callee)});
+                } else {
+                    Checks.push_back({Builder.CreateCall(check_limit), Ann.kind, 0});
+                }
+            }
+            Changed = true;
+        }
+    };
+
     for (llvm::Function &Function : Module) {
         if (Function.isDeclaration()) {
             continue;
         }
+        llvm::SmallVector<InjectedCheck, 8> Checks;
+
+        if (auto Found = Index.find(&Function); is_prologue && Found != Index.end()) {
+            // The check is placed after the allocas of the entry block with the location of the function's opening brace
+            llvm::DebugLoc Loc;
+            if (llvm::DISubprogram *SP = Function.getSubprogram()) {
+                Loc = llvm::DILocation::get(Module.getContext(), SP->getScopeLine(), 0, SP);
+            }
+            InjectChecks(*Function.getEntryBlock().getFirstNonPHIOrDbgOrAlloca(), Loc, Function.getName(), Found->second, Checks);
+            Verbose(SourceLocation(), std::format("Inject the check in the prologue of {}", Function.getName().str()));
+        }
+
         for (llvm::BasicBlock &Block : Function) {
             for (llvm::BasicBlock::iterator DI = Block.begin(); DI != Block.end();) {
                 // for (llvm::Instruction &Instruction : Block) {
@@ -274,8 +1318,9 @@ llvm::PreservedAnalyses DebugInjectorPass::run(llvm::Module &Module, llvm::Modul
 
                         if (CurrentCallee->getName().compare("_ZN5trust11stack_check17ignore_next_checkEm") == 0) {
 
+                            // In the prologue mode, the checks are not related to the calls and are not skipped
                             const llvm::Value *val = Call->getArgOperand(0);
-                            if (auto *ci = dyn_cast<llvm::ConstantInt>(val)) {
+                            if (auto *ci = dyn_cast<llvm::ConstantInt>(val); ci && !is_prologue) {
                                 skip_injection = ci->getZExtValue();
                                 Verbose(SourceLocation(), std::format("Set skip injectioon to {}", skip_injection));
                             }
@@ -285,37 +1330,32 @@ llvm::PreservedAnalyses DebugInjectorPass::run(llvm::Module &Module, llvm::Modul
                             continue;
                         }
 
-                        auto Ann = getAnnotationsForValue(Module, CurrentCallee);
-                        if (!Ann.empty()) {
-                            for (auto &S : Ann) {
-                                if (S.find(stack_check_size) != std::string::npos) {
-                                    size_t stack_size = atoi(&S[stack_check_size.size() + 1]);
-                                    if (skip_injection) {
-                                        Verbose(SourceLocation(), std::format("Code injection skipped {} for {}", skip_injection, S));
-                                        skip_injection--;
-                                    } else {
-                                        llvm::IRBuilder<> Builder(Call->getContext());
-                                        Builder.SetInsertPoint(Call);
-                                        Builder.CreateCall(check_size, {Builder.getInt64(stack_size)});
-                                        Changed = true;
-                                    }
-                                } else if (S.find(stack_check_limit) != std::string::npos) {
-                                    if (skip_injection) {
-                                        Verbose(SourceLocation(), std::format("Code injection skipped {} for {}", skip_injection, S));
-                                        skip_injection--;
-                                    } else {
-                                        llvm::IRBuilder<> Builder(Call->getContext());
-                                        Builder.SetInsertPoint(Call);
-                                        Builder.CreateCall(check_limit);
-                                        Changed = true;
-                                    }
-                                }
-                            }
+                        if (auto Found = Index.find(CurrentCallee); !is_prologue && Found != Index.end()) {
+                            InjectChecks(*Call, Call->getDebugLoc(), CurrentCallee->getName(), Found->second, Checks);
+                        }
+                        if (RecursiveCalls.contains(Call) && !Excluded.contains(CurrentCallee)) {
+                            InjectChecks(*Call, Call->getDebugLoc(), CurrentCallee->getName(), RecursionCheck, Checks);
+                        }
+                    } else if (!is_prologue && !Call->isInlineAsm()) {
+                        // In the prologue mode, the targets of indirect calls check themselves
+                        if (const MergedChecks Targets = getIndirectChecks(Indirect, *Call, Module.getDataLayout()); !Targets.empty()) {
+                            Verbose(SourceLocation(), std::format("Inject the worst-case check of the indirect call in {}",
+                                                                  Function.getName().str()));
+                            InjectChecks(*Call, Call->getDebugLoc(), "<indirect>", Targets, Checks);
                         }
                     }
                 }
             }
         }
+
+        if (Optimize && !Checks.empty()) {
+            OptimizeChecks(Function, Checks);
+        }
+        if (Expand) {
+            for (const InjectedCheck &Check : Checks) {
+                ExpandCheck(Module, *Info, Check);
+            }
+        }
     }
 
     if (Changed) {
@@ -391,6 +1431,13 @@ class TrustPluginASTConsumer : public ASTConsumer {
     void HandleTranslationUnit(ASTContext &context) override {
         context.getParentMapContext().setTraversalKind(clang::TraversalKind::TK_IgnoreUnlessSpelledInSource);
         plugin->TraverseDecl(context.getTranslationUnitDecl());
+
+        // The inline code of the check compares the frame address, so in the other modes of the header
+        // the check functions are called (and inlined by the optimizer)
+        Preprocessor &PP = plugin->m_CI.getPreprocessor();
+        if (PP.isMacroDefined("STACK_CHECK_STACK_POINTER") || PP.isMacroDefined("STACK_CHECK_HIGH_WATER_MARK")) {
+            is_inline = false;
+        }
     }
 };
 
@@ -407,6 +1454,8 @@ class TrustPluginASTAction : public PluginASTAction {
 
         std::unique_ptr<TrustPluginASTConsumer> obj = std::unique_ptr<TrustPluginASTConsumer>(new TrustPluginASTConsumer());
 
+        codegen_options = &Compiler.getCodeGenOpts();
+
         Compiler.getCodeGenOpts().PassPlugins.push_back(getThisPluginPath());
 
         return obj;
@@ -450,6 +1499,40 @@ class TrustPluginASTAction : public PluginASTAction {
             if (first.compare("verbose") == 0 || first.compare("v") == 0) {
                 is_verbose = true;
                 PrintColor(llvm::outs(), "Enable verbose mode");
+            } else if (first.compare("no-coalesce") == 0) {
+                is_coalesce = false;
+                PrintColor(llvm::outs(), "Disable coalescing of checks");
+            } else if (first.compare("prologue") == 0) {
+                is_prologue = true;
+                PrintColor(llvm::outs(), "Inject checks in the prologue of annotated functions");
+            } else if (first.compare("profile") == 0) {
+                is_profile = true;
+                PrintColor(llvm::outs(), "Place checks in colder blocks by the profile data");
+            } else if (first.compare("recursion") == 0) {
+                is_recursion = true;
+                PrintColor(llvm::outs(), "Check the recursive calls on the back edges of the call graph");
+            } else if (first.compare("include") == 0 || first.compare("exclude") == 0) {
+                llvm::Expected<llvm::GlobPattern> Pattern = llvm::GlobPattern::create(second);
+                if (second.empty() || !Pattern) {
+                    llvm::errs() << "Invalid name mask in the plugin argument: '" << elem << "'";
+                    if (!Pattern) {
+                        llvm::errs() << " (" << llvm::toString(Pattern.takeError()) << ")";
+                    }
+                    llvm::errs() << "!\n";
+                    return false;
+                }
+                (first.compare("include") == 0 ? include_masks : exclude_masks).emplace_back(second, std::move(*Pattern));
+                PrintColor(llvm::outs(), "{} the functions by the name mask '{}'", first.compare("include") == 0 ? "Protect" : "Exclude",
+                           second);
+            } else if (first.compare("no-inline") == 0) {
+                is_inline = false;
+                PrintColor(llvm::outs(), "Disable inline expansion of checks");
+            } else if (first.compare("no-hoist") == 0) {
+                is_hoist = false;
+                PrintColor(llvm::outs(), "Disable hoisting of checks out of loops");
+            } else if (first.compare("counters") == 0) {
+                is_counters = true;
+                PrintColor(llvm::outs(), "Enable call site counters");
             } else {
                 llvm::errs() << "Unknown plugin argument: '" << elem << "'!\n";
                 return false;
@@ -483,7 +1566,10 @@ extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo llvmGetPassPluginIn
     static ::llvm::PassPluginLibraryInfo PluginInfo = {
         LLVM_PLUGIN_API_VERSION, "stack_check", "0.1", [](::llvm::PassBuilder &PB) {
             PB.registerPipelineStartEPCallback(
-                [](::llvm::ModulePassManager &MPM, ::llvm::OptimizationLevel) { MPM.addPass(DebugInjectorPass()); });
+                [](::llvm::ModulePassManager &MPM, ::llvm::OptimizationLevel Level) {
+                    // The per-site counters count each call, so their checks are not moved or merged
+                    MPM.addPass(DebugInjectorPass(!is_counters && Level != ::llvm::OptimizationLevel::O0));
+                });
         }};
     return PluginInfo;
 }
@@ -0,0 +1,381 @@
+#!/usr/bin/env python3
+"""
+Usage:
+  stack_depth.py [options] <binary>
+
+Computes the worst-case stack depth of a linked program (an executable file or a shared library).
+The frame sizes of the functions are read from the `.stack_sizes` section of the binary
+(compile with -fstack-size-section), and the call graph is extracted from its disassembly (objdump -d).
+
+For each entry point, the maximum stack requirement and the call chain that reaches it are printed.
+Recursive cycles, functions with dynamic stack allocation (from the .su files of -fstack-usage)
+and indirect calls have no static bound, so the functions where a check is needed are listed at the end.
+A check before the calls of all other functions can be dropped, and the bound of an entry point
+without such functions is the exact stack size required by its thread.
+
+Options:
+  -e, --entry NAME   entry point (mangled or demangled name), can be repeated; by default 'main',
+                     or all functions without callers if there is no 'main'
+  --su DIR           directory with .su files (-fstack-usage) to detect dynamic stack allocation
+                     and to take the sizes of the functions missing from the .stack_sizes section
+  --no-demangle      print mangled names
+  -h, --help         print this help
+
+Exit codes:
+  0 - the analysis is done
+  2 - parameter or file error
+"""
+
+import argparse
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+
+EM_X86_64 = 62
+EM_AARCH64 = 183
+
+
+class ElfError(Exception):
+    pass
+
+
+class Program:
+    """Functions of an ELF file with their frame sizes, read from the section and symbol tables."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as file:
+            data = file.read()
+        if data[:4] != b'\x7fELF' or data[4] != 2 or data[5] != 1:
+            raise ElfError(f"'{path}' is not a 64-bit little-endian ELF file")
+
+        self.machine = struct.unpack_from('<H', data, 18)[0]
+        if self.machine not in (EM_X86_64, EM_AARCH64):
+            raise ElfError(f"Unsupported ELF machine {self.machine} (only x86_64 and AArch64)")
+        # The return address is pushed by the call on x86_64, and on AArch64 it is saved in the frame
+        self.return_size = 8 if self.machine == EM_X86_64 else 0
+
+        shoff, = struct.unpack_from('<Q', data, 40)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 58)
+        sections = []
+        for i in range(shnum):
+            name, stype, _, _, offset, size, link, _, _, entsize = struct.unpack_from('<IIQQQQIIQQ', data, shoff + i * shentsize)
+            sections.append((name, stype, offset, size, link, entsize))
+        names_offset = sections[shstrndx][2]
+
+        def section_name(section):
+            end = data.index(b'\0', names_offset + section[0])
+            return data[names_offset + section[0]:end].decode()
+
+        # Function symbols by address (aliases of the same address keep the first name)
+        self.names = {}
+        symtab = [s for s in sections if s[1] == 2] or [s for s in sections if s[1] == 11]
+        for sym_section in symtab:
+            strings = sections[sym_section[4]][2]
+            for pos in range(sym_section[2], sym_section[2] + sym_section[3], sym_section[5]):
+                name, info, _, shndx, value, _ = struct.unpack_from('<IBBHQQ', data, pos)
+                if info & 0xf == 2 and shndx != 0 and value:
+                    end = data.index(b'\0', strings + name)
+                    self.names.setdefault(value, data[strings + name:end].decode())
+
+        # The records of .stack_sizes: the function address (8 bytes) and the frame size (ULEB128)
+        self.sizes = {}
+        for section in sections:
+            if section_name(section) != '.stack_sizes':
+                continue
+            pos, end = section[2], section[2] + section[3]
+            while pos < end:
+                addr, = struct.unpack_from('<Q', data, pos)
+                pos += 8
+                size, shift = 0, 0
+                while True:
+                    byte = data[pos]
+                    pos += 1
+                    size |= (byte & 0x7f) << shift
+                    shift += 7
+                    if not byte & 0x80:
+                        break
+                if addr in self.names:
+                    name = self.names[addr]
+                    self.sizes[name] = max(self.sizes.get(name, 0), size)
+
+
+class Function:
+    def __init__(self, name):
+        self.name = name
+        self.size = None
+        self.dynamic = False
+        self.indirect = False
+        self.calls = set()
+        self.tail_calls = set()
+        self.external = set()
+
+
+def read_call_graph(path, program):
+    """Direct calls, tail calls and indirect calls of each function from the disassembly."""
+    objdump = shutil.which('objdump') or shutil.which('llvm-objdump')
+    if not objdump:
+        raise ElfError("objdump is not found")
+    result = subprocess.run([objdump, '-d', '-w', '--no-show-raw-insn', path], capture_output=True, text=True)
+    if result.returncode:
+        raise ElfError(result.stderr.strip())
+
+    if program.machine == EM_X86_64:
+        calls, jumps, indirect = {'call', 'callq'}, {'jmp', 'jmpq'}, set()
+    else:
+        calls, jumps, indirect = {'bl'}, {'b'}, {'blr'}
+
+    header = re.compile(r'^([0-9a-f]+) <(.+)>:$')
+    target = re.compile(r'^([0-9a-f]+) <([^>]+?)(\+0x[0-9a-f]+)?>')
+    functions = {}
+    current = None
+    for line in result.stdout.splitlines():
+        match = header.match(line)
+        if match:
+            name = program.names.get(int(match.group(1), 16), match.group(2))
+            current = functions.setdefault(name, Function(name))
+            continue
+        if current is None or ':\t' not in line:
+            continue
+
+        fields = line.split(':\t', 1)[1].split(None, 1)
+        # Instruction prefixes (bnd, notrack) are skipped
+        while len(fields) == 2 and fields[0] in ('bnd', 'notrack'):
+            fields = fields[1].split(None, 1)
+        if not fields:
+            continue
+        mnemonic, operand = fields[0], fields[1].strip() if len(fields) == 2 else ''
+
+        if mnemonic in indirect or (mnemonic in calls and operand.startswith('*')):
+            current.indirect = True
+            continue
+        if mnemonic not in calls and mnemonic not in jumps:
+            continue
+        match = target.match(operand)
+        if not match:
+            if mnemonic in calls:
+                current.indirect = True
+            continue
+
+        addr = int(match.group(1), 16)
+        callee = program.names.get(addr)
+        if mnemonic in jumps:
+            # A jump to the beginning of another function is a tail call, other jumps are inside the function
+            if callee and callee != current.name and not match.group(3):
+                current.tail_calls.add(callee)
+        elif callee:
+            current.calls.add(callee)
+        else:
+            current.external.add(match.group(2).split('@')[0])
+    return functions
+
+
+def read_su(directory):
+    """Sizes and qualifiers of the .su files: 'file:line:column:function<TAB>size<TAB>qualifiers'."""
+    result = {}
+    for root, _, files in os.walk(directory):
+        for file in sorted(files):
+            if not file.endswith('.su'):
+                continue
+            with open(os.path.join(root, file), errors='replace') as su:
+                for line in su:
+                    parts = line.rstrip('\n').split('\t')
+                    if len(parts) < 3 or not parts[1].isdigit():
+                        continue
+                    name = parts[0].rsplit(':', 1)[-1]
+                    result[name] = (int(parts[1]), parts[2])
+    return result
+
+
+def strongly_connected(functions):
+    """Tarjan's algorithm without recursion, returns the components in reverse topological order (callees first)."""
+    index, low, on_stack, stack, components = {}, {}, set(), [], []
+    counter = 0
+    for start in sorted(functions):
+        if start in index:
+            continue
+        work = [(start, iter(sorted(functions[start].calls | functions[start].tail_calls)))]
+        index[start] = low[start] = counter
+        counter += 1
+        stack.append(start)
+        on_stack.add(start)
+        while work:
+            node, edges = work[-1]
+            advanced = False
+            for callee in edges:
+                if callee not in functions:
+                    continue
+                if callee not in index:
+                    index[callee] = low[callee] = counter
+                    counter += 1
+                    stack.append(callee)
+                    on_stack.add(callee)
+                    work.append((callee, iter(sorted(functions[callee].calls | functions[callee].tail_calls))))
+                    advanced = True
+                    break
+                if callee in on_stack:
+                    low[node] = min(low[node], index[callee])
+            if advanced:
+                continue
+            work.pop()
+            if work:
+                low[work[-1][0]] = min(low[work[-1][0]], low[node])
+            if low[node] == index[node]:
+                component = []
+                while True:
+                    member = stack.pop()
+                    on_stack.discard(member)
+                    component.append(member)
+                    if member == node:
+                        break
+                components.append(sorted(component))
+    return components
+
+
+def analyze(functions, return_size):
+    """The bounded part of the worst-case depth of each function, the deepest callee and the reasons without a bound."""
+    depth, deepest, unbounded = {}, {}, {}
+    recursive = set()
+    for component in strongly_connected(functions):
+        if len(component) > 1 or component[0] in functions[component[0]].calls | functions[component[0]].tail_calls:
+            recursive.update(component)
+        for name in component:
+            func = functions[name]
+            reasons = set()
+            if name in recursive:
+                reasons.add('recursion')
+            if func.dynamic:
+                reasons.add('dynamic stack')
+            if func.indirect:
+                reasons.add('indirect call')
+
+            frame = return_size + (func.size or 0)
+            best, best_callee = frame, None
+            for callee in sorted(func.calls | func.tail_calls):
+                if callee not in depth:
+                    continue  # A call inside the same recursive component
+                value = depth[callee] + (frame if callee in func.calls else 0)
+                if value > best:
+                    best, best_callee = value, callee
+                if unbounded[callee]:
+                    reasons.add(f'via {callee}')
+            depth[name], deepest[name], unbounded[name] = best, best_callee, reasons
+    return depth, deepest, unbounded, recursive
+
+
+def main():
+    parser = argparse.ArgumentParser(add_help=False)
+    parser.add_argument('binary', nargs='?')
+    parser.add_argument('-e', '--entry', action='append', default=[])
+    parser.add_argument('--su')
+    parser.add_argument('--no-demangle', action='store_true')
+    parser.add_argument('-h', '--help', action='store_true')
+    args, unknown = parser.parse_known_args()
+
+    if args.help:
+        print(__doc__.strip())
+        return 0
+    if unknown or not args.binary:
+        print(f"Error: unknown argument '{unknown[0]}'." if unknown else "Error: the binary file is expected.", file=sys.stderr)
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    if args.su and not os.path.isdir(args.su):
+        print(f"Error: '{args.su}' is not a directory.", file=sys.stderr)
+        return 2
+
+    try:
+        program = Program(args.binary)
+        functions = read_call_graph(args.binary, program)
+    except (OSError, ElfError) as error:
+        print(f"Error: {error}", file=sys.stderr)
+        return 2
+
+    if not program.sizes:
+        print(f"Warning: the '.stack_sizes' section is not found in '{args.binary}', use the -fstack-size-section option.", file=sys.stderr)
+
+    su = read_su(args.su) if args.su else {}
+    for name, func in functions.items():
+        func.size = program.sizes.get(name)
+        if name in su:
+            size, qualifiers = su[name]
+            if func.size is None:
+                func.size = size
+            func.dynamic = qualifiers.startswith('dynamic') and 'bounded' not in qualifiers
+
+    # Only the functions of the compiled code are analyzed (the .text of the startup files has no frame sizes)
+    known = {name for name, func in functions.items() if func.size is not None}
+    for func in functions.values():
+        for callee in list(func.calls | func.tail_calls):
+            if callee not in known:
+                func.calls.discard(callee)
+                func.tail_calls.discard(callee)
+                func.external.add(callee)
+    functions = {name: functions[name] for name in known}
+
+    depth, deepest, unbounded, recursive = analyze(functions, program.return_size)
+
+    names = sorted(functions)
+    demangled = {name: name for name in names}
+    filt = shutil.which('c++filt')
+    if filt and names:
+        result = subprocess.run([filt], input='\n'.join(names), capture_output=True, text=True)
+        demangled.update(zip(names, result.stdout.splitlines()))
+    pretty = {name: name for name in names} if args.no_demangle else demangled
+
+    entries = []
+    for entry in args.entry or (['main'] if 'main' in functions else []):
+        found = [name for name in names if entry in (name, demangled[name]) or demangled[name].startswith(entry + '(')]
+        if not found:
+            print(f"Error: the entry point '{entry}' is not found.", file=sys.stderr)
+            return 2
+        entries.extend(found)
+    if not entries:
+        called = set()
+        for func in functions.values():
+            called |= func.calls | func.tail_calls
+        entries = [name for name in names if name not in called]
+
+    def is_needed(name):
+        return any(not reason.startswith('via ') for reason in unbounded[name])
+
+    for entry in entries:
+        chain, name = [], entry
+        while name:
+            chain.append(pretty[name])
+            name = deepest[name]
+        print(f"Entry point: {pretty[entry]}")
+        bound = 'unbounded' if unbounded[entry] else 'bounded'
+        print(f"  Worst case: {depth[entry]} bytes ({bound})")
+        print(f"  Call chain: {' -> '.join(chain)}")
+
+        # The reachable functions without a static bound, whose depth is not included in the worst case
+        reached, queue = {entry}, [entry]
+        while queue:
+            func = functions[queue.pop()]
+            for callee in sorted(func.calls | func.tail_calls):
+                if callee not in reached:
+                    reached.add(callee)
+                    queue.append(callee)
+        causes = [pretty[name] for name in names if name in reached and is_needed(name)]
+        if causes:
+            print(f"  Without a static bound: {', '.join(causes)}")
+
+    cycles = [c for c in strongly_connected(functions) if set(c) <= recursive]
+    if cycles:
+        print("Recursive cycles:")
+        for cycle in cycles:
+            print(f"  {' <-> '.join(pretty[name] for name in cycle)}")
+
+    needed = [name for name in names if is_needed(name)]
+    print(f"Functions without a static bound, where a check is needed: {len(needed)}")
+    for name in needed:
+        reasons = sorted(r for r in unbounded[name] if not r.startswith('via '))
+        print(f"  {pretty[name]}: {', '.join(reasons)}")
+    print(f"Functions with a static bound: {len(names) - len([n for n in names if unbounded[n]])} of {len(names)}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
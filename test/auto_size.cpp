@@ -0,0 +1,66 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O0 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -S -emit-llvm %s -o %p/temp/auto-size-O0.ll \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/auto-size-O0.ll
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S -emit-llvm %s -o %p/temp/auto-size-O2.ll \
+// RUN: && FileCheck %s -check-prefix=INLINE < %p/temp/auto-size-O2.ll
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: %s -o %p/temp/auto-size-O2 \
+// RUN: && %p/temp/auto-size-O2 | FileCheck %s -check-prefix=EXEC
+
+#include <iostream>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+// Размер кадра функции определяется автоматически: плагин включает секцию .stack_sizes (-fstack-size-section),
+// а размер считывается из неё при первой проверке
+
+STACK_CHECK_SIZE(0)
+[[gnu::noinline]] size_t deep_call(size_t depth) {
+    volatile char buffer[4000];
+    buffer[0] = static_cast<char>(depth);
+    size_t result = depth ? deep_call(depth - 1) : 0;
+    // Prevents the tail call
+    asm volatile("" ::: "memory");
+    return result + buffer[0];
+}
+
+// IR: @__stack_check_frame._Z9deep_callm = internal global { ptr, i64 } { ptr @_Z9deep_callm, i64 4611686018427387903 }, align 8
+
+// IR-LABEL: define {{.*}}i64 @_Z9deep_callm(
+// IR: call void @_ZN5trust11stack_check20check_overflow_frameEPNS_17stack_check_frameE(ptr @__stack_check_frame._Z9deep_callm)
+// IR-NEXT: call {{.*}}i64 @_Z9deep_callm(
+
+// INLINE-LABEL: define {{.*}}i64 @_Z9deep_callm(
+// INLINE: load atomic i64, ptr {{.*}}@__stack_check_frame._Z9deep_callm{{.*}} monotonic
+// INLINE: call void @_ZN5trust11stack_check18check_frame_failedEPNS_17stack_check_frameE(ptr {{.*}}@__stack_check_frame._Z9deep_callm)
+
+int main() {
+    std::cout << "Frame size: " << (StackSizesIndex::instance().getStackSize(reinterpret_cast<void *>(&deep_call)) >= 4000) << "\n";
+    // EXEC: Frame size: 1
+
+    deep_call(10);
+    std::cout << "Short recursion: ok\n";
+    // EXEC: Short recursion: ok
+
+    try {
+        deep_call(100'000'000);
+        std::cout << "Deep recursion: no overflow\n";
+    } catch (stack_overflow &) {
+        std::cout << "Deep recursion: stack overflow\n";
+    }
+    // EXEC: Deep recursion: stack overflow
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+/*
+ * Benchmark of the placement of the checks injected by the plugin.
+ *
+ * One guarded function is called from many different functions (callers). With the default placement,
+ * the plugin inserts a check before each call, so the code grows with the number of callers,
+ * and with the `prologue` plugin argument, the check is inserted once at the beginning of the guarded function.
+ * The program measures the time of calls through all callers compared with the same callers of a function
+ * without the attribute, and the size of the code of both sets of callers is compared by the `size` utility
+ * for the programs built with both placements.
+ */
+
+constexpr size_t callers = 1000;
+
+size_t counter = 0;
+
+STACK_CHECK_SIZE(1000)
+[[gnu::noinline]] size_t guarded(size_t value) {
+    counter += value;
+    // Prevents the calls from being removed or merged
+    asm volatile("");
+    return counter;
+}
+
+[[gnu::noinline]] size_t plain(size_t value) {
+    counter += value;
+    // Prevents the calls from being removed or merged
+    asm volatile("");
+    return counter;
+}
+
+template <size_t N> [[gnu::noinline]] size_t guarded_caller(size_t value) { return guarded(value + N) ^ N; }
+template <size_t N> [[gnu::noinline]] size_t plain_caller(size_t value) { return plain(value + N) ^ N; }
+
+typedef size_t (*Caller)(size_t);
+
+template <size_t... N> constexpr std::array<Caller, sizeof...(N)> make_guarded(std::index_sequence<N...>) { return {&guarded_caller<N>...}; }
+template <size_t... N> constexpr std::array<Caller, sizeof...(N)> make_plain(std::index_sequence<N...>) { return {&plain_caller<N>...}; }
+
+static const std::array<Caller, callers> guarded_callers = make_guarded(std::make_index_sequence<callers>());
+static const std::array<Caller, callers> plain_callers = make_plain(std::make_index_sequence<callers>());
+
+size_t measure(const std::array<Caller, callers> &table, size_t rounds) {
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t result = 0;
+    for (size_t i = 0; i < rounds; i++) {
+        for (Caller caller : table) {
+            result += caller(i);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (result == 42) {
+        std::cout << "Oops. Very good optimization!\n";
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        std::cerr << "Using: callers_bench [rounds]\nBy default, 100000 rounds of calls through " << callers << " callers are used."
+                  << std::endl;
+        return 1;
+    }
+
+    size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    if (!rounds) {
+        rounds = 1;
+    }
+
+    // The stack parameters of the thread are queried before the measurement
+    stack_check::init_thread();
+
+    size_t plain_time = measure(plain_callers, rounds);
+    size_t guarded_time = measure(guarded_callers, rounds);
+
+    std::cout << "Callers: " << callers << ", calls: " << callers * rounds << std::endl;
+    std::cout << "Calls without checks:  " << plain_time << " nanosecs" << std::endl;
+    std::cout << "Guarded calls:         " << guarded_time << " nanosecs" << std::endl;
+    std::cout << "Stack overflow checks reduce speed: " << (guarded_time - (double)plain_time) * 100.0 / plain_time << "%" << std::endl;
+
+    return 0;
+}
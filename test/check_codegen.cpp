@@ -0,0 +1,91 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -S -emit-llvm %s -o %p/temp/check-codegen-O2.ll \
+// RUN: && FileCheck %s -check-prefix=IR --implicit-check-not=_ZTWN5trust11stack_check4infoE < %p/temp/check-codegen-O2.ll
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -S %s -o %p/temp/check-codegen-O2.s \
+// RUN: && FileCheck %s -check-prefix=ASM --implicit-check-not=_ZTWN5trust11stack_check4infoE < %p/temp/check-codegen-O2.s
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -fPIC -S %s -o %p/temp/check-codegen-pic-O2.s \
+// RUN: && FileCheck %s -check-prefix=PIC < %p/temp/check-codegen-pic-O2.s
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -fPIC -DSTACK_CHECK_INITIAL_EXEC -S %s -o %p/temp/check-codegen-pic-ie-O2.s \
+// RUN: && FileCheck %s -check-prefix=PIC-IE --implicit-check-not=__tls_get_addr < %p/temp/check-codegen-pic-ie-O2.s
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -fomit-frame-pointer -DSTACK_CHECK_STACK_POINTER -S %s -o %p/temp/check-codegen-sp-O2.s \
+// RUN: && FileCheck %s -check-prefix=SP < %p/temp/check-codegen-sp-O2.s
+
+#include "stack_check.h"
+
+//
+// The thread-local variable `trust::stack_check::info` is constant-initialized,
+// so the check is one TLS load, one compare and one branch without calling
+// the dynamic initialization wrapper of the thread-local variable.
+//
+
+extern "C" void guarded_limit() { trust::stack_check::check_limit(); }
+
+// IR-LABEL: define {{.*}}void @guarded_limit()
+// IR-NOT: call {{.*}}@_Z
+// IR: load i64, ptr {{.*}}
+// IR-NEXT: icmp ult i64
+// IR-NEXT: br i1
+
+// ASM-LABEL: guarded_limit:
+// ASM-NOT: call
+// ASM: cmpq %fs:{{.*}}_ZN5trust11stack_check4infoE{{.*}}, %rbp
+// ASM-NEXT: jb
+// ASM-NOT: %fs:
+// ASM: .cfi_endproc
+
+//
+// In position-independent code for shared libraries, the default global-dynamic TLS model
+// calls `__tls_get_addr` on every check, and the initial-exec model (STACK_CHECK_INITIAL_EXEC)
+// loads the TLS offset from the GOT and compares the stack frame with a %fs-relative operand.
+//
+
+// PIC-LABEL: guarded_limit:
+// PIC: {{__tls_get_addr|TLSDESC|tlsdesc}}
+// PIC: .cfi_endproc
+
+// PIC-IE-LABEL: guarded_limit:
+// PIC-IE-NOT: call
+// PIC-IE: _ZN5trust11stack_check4infoE@{{GOTTPOFF|gottpoff}}(%rip), %[[REG:r[a-z0-9]+]]
+// PIC-IE-NOT: call
+// PIC-IE: cmpq %fs:{{[0-9]*}}(%[[REG]]), %rbp
+// PIC-IE-NEXT: jb
+// PIC-IE: .cfi_endproc
+
+extern "C" void guarded_overflow() { trust::stack_check::check_overflow(1000); }
+
+// IR-LABEL: define {{.*}}void @guarded_overflow()
+// IR-NOT: call {{.*}}@_Z
+// IR: load i64, ptr {{.*}}
+// IR-NEXT: add i64 {{.*}}1000
+// IR-NEXT: icmp ult i64
+// IR-NEXT: br i1
+
+// ASM-LABEL: guarded_overflow:
+// ASM-NOT: call
+// ASM: {{movq|addq}} %fs:{{.*}}_ZN5trust11stack_check4infoE{{.*}}, %[[REG:r[a-z0-9]+]]
+// ASM-NOT: %fs:
+// ASM: cmpq %[[REG]], %rbp
+// ASM-NEXT: jb
+// ASM-NOT: %fs:
+// ASM: .cfi_endproc
+
+//
+// In the stack pointer mode (STACK_CHECK_STACK_POINTER), the check does not require the frame pointer setup.
+//
+
+// SP-LABEL: guarded_limit:
+// SP-NOT: %rbp
+// SP: cmpq %fs:{{.*}}_ZN5trust11stack_check4infoE{{.*}}, %r{{[a-z0-9]+}}
+// SP-NEXT: jb
+// SP: .cfi_endproc
+
+// SP-LABEL: guarded_overflow:
+// SP-NOT: %rbp
+// SP: {{movq|addq}} %fs:{{.*}}_ZN5trust11stack_check4infoE{{.*}}, %[[REG:r[a-z0-9]+]]
+// SP-NOT: %fs:
+// SP: cmpq %[[REG]], %r{{[a-z0-9]+}}
+// SP-NEXT: jb
+// SP: .cfi_endproc
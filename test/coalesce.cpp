@@ -0,0 +1,182 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O1 -fno-inline \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang verbose -Rpass=stack-check \
+// RUN: -S -emit-llvm %s -o %p/temp/coalesce-O1.ll > %p/temp/coalesce-O1.out 2> %p/temp/coalesce-O1.err \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/coalesce-O1.ll \
+// RUN: && FileCheck %s -check-prefix=OUT < %p/temp/coalesce-O1.out \
+// RUN: && FileCheck %s -check-prefix=REMARK < %p/temp/coalesce-O1.err
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O1 -fno-inline \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-coalesce \
+// RUN: -S -emit-llvm %s -o %p/temp/coalesce-no-O1.ll \
+// RUN: && FileCheck %s -check-prefix=NO < %p/temp/coalesce-no-O1.ll
+
+#include <cstdlib>
+
+#include "stack_check.h"
+
+// Без оптимизации (-O0) проверки не объединяются, а чтобы вызовы проверок были видны в IR,
+// они не раскрываются плагином (no-inline) и не встраиваются оптимизатором (-fno-inline)
+
+int counter = 0;
+
+STACK_CHECK_SIZE(100)
+[[gnu::noinline]] void small_frame() { counter += 1; }
+
+STACK_CHECK_SIZE(300)
+[[gnu::noinline]] void large_frame() { counter += 2; }
+
+STACK_CHECK_SIZE(200)
+[[gnu::noinline]] void middle_frame() { counter += 3; }
+
+STACK_CHECK_LIMIT
+[[gnu::noinline]] void limit_frame() { counter += 4; }
+
+// The checks of a sequence of calls are merged into the first one with the maximum size
+void sequence() {
+    small_frame();
+    large_frame();
+    middle_frame();
+}
+
+// IR-LABEL: define {{.*}}void @_Z8sequencev()
+// IR-NOT: @_ZN5trust11stack_check14check_overflowEm
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}300)
+// IR-NEXT: call void @_Z11small_framev()
+// IR-NEXT: call void @_Z11large_framev()
+// IR-NEXT: call void @_Z12middle_framev()
+// IR-NEXT: ret void
+
+// NO-LABEL: define {{.*}}void @_Z8sequencev()
+// NO: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// NO-NEXT: call void @_Z11small_framev()
+// NO-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}300)
+// NO-NEXT: call void @_Z11large_framev()
+// NO-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}200)
+// NO-NEXT: call void @_Z12middle_framev()
+
+// A larger check on a conditional path is kept, because it is not needed on the other path,
+// and a smaller check after the dominating one is removed
+void branch(bool flag) {
+    small_frame();
+    if (flag) {
+        large_frame();
+    }
+    small_frame();
+    limit_frame();
+    limit_frame();
+}
+
+// IR-LABEL: define {{.*}}void @_Z6branchb(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z11small_framev()
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}300)
+// IR-NEXT: call void @_Z11large_framev()
+// IR-NOT: call void @_ZN5trust11stack_check14check_overflowEm
+// IR: call void @_Z11small_framev()
+// IR-NEXT: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call void @_Z11limit_framev()
+// IR-NEXT: call void @_Z11limit_framev()
+// IR-NEXT: ret void
+
+// Defined in another translation unit, so it may throw or not return
+void opaque_call();
+
+// The larger check is not moved before a call that may throw or not return,
+// and the smaller check after it is still removed
+void opaque() {
+    small_frame();
+    opaque_call();
+    large_frame();
+    middle_frame();
+}
+
+// IR-LABEL: define {{.*}}void @_Z6opaquev()
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z11small_framev()
+// IR-NEXT: call void @_Z11opaque_callv()
+// IR-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}300)
+// IR-NEXT: call void @_Z11large_framev()
+// IR-NEXT: call void @_Z12middle_framev()
+// IR-NEXT: ret void
+
+[[noreturn]] [[gnu::noinline]] void stop(int code) { std::exit(code); }
+
+// Returns only if the code is zero, the call of the noreturn function is visible in its body
+[[gnu::noinline]] void maybe_stop(int code) {
+    if (code) {
+        stop(code);
+    }
+}
+
+// The larger check is not moved before a call of a function of this translation unit that may not return
+void noreturn_path(int code) {
+    small_frame();
+    maybe_stop(code);
+    large_frame();
+    middle_frame();
+}
+
+// IR-LABEL: define {{.*}}void @_Z13noreturn_pathi(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z11small_framev()
+// IR: call void @_Z10maybe_stopi(
+// IR-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}300)
+// IR-NEXT: call void @_Z11large_framev()
+// IR-NEXT: call void @_Z12middle_framev()
+// IR-NEXT: ret void
+
+[[gnu::noinline]] void may_throw(int code) {
+    if (code) {
+        throw code;
+    }
+}
+
+// All exceptions are caught, so the later check is executed on both paths, but it is not moved before the invoke
+void invoke_path(int code) {
+    small_frame();
+    try {
+        may_throw(code);
+    } catch (...) {
+        counter = 0;
+    }
+    large_frame();
+}
+
+// IR-LABEL: define {{.*}}void @_Z11invoke_pathi(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z11small_framev()
+// IR: invoke void @_Z9may_throwi(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}300)
+// IR-NEXT: call void @_Z11large_framev()
+
+// The stack pointer is moved by a dynamic alloca, so the checks are not merged
+void dynamic(size_t size) {
+    small_frame();
+    char *buffer = static_cast<char *>(__builtin_alloca(size));
+    buffer[0] = 0;
+    small_frame();
+}
+
+// IR-LABEL: define {{.*}}void @_Z7dynamicm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z11small_framev()
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z11small_framev()
+
+// OUT: verbose: Elided 2 of 3 stack checks in _Z8sequencev
+// OUT: verbose: Elided 2 of 5 stack checks in _Z6branchb
+// OUT: verbose: Elided 1 of 3 stack checks in _Z6opaquev
+// OUT: verbose: Elided 1 of 3 stack checks in _Z13noreturn_pathi
+// OUT-NOT: _Z11invoke_pathi
+// OUT-NOT: _Z7dynamicm
+
+// REMARK: remark: elided 2 of 3 stack checks [-Rpass=stack-check]
+// REMARK: remark: elided 2 of 5 stack checks [-Rpass=stack-check]
+// REMARK: remark: elided 1 of 3 stack checks [-Rpass=stack-check]
+// REMARK: remark: elided 1 of 3 stack checks [-Rpass=stack-check]
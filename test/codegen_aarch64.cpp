@@ -0,0 +1,72 @@
+// REQUIRES: aarch64-sysroot
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -target aarch64-linux-gnu -O1 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S %s -o %p/temp/codegen-aarch64-O1.s \
+// RUN: && grep -v -E '^[[:space:]]*(\.[a-z]|//)' %p/temp/codegen-aarch64-O1.s | FileCheck %s -check-prefix=A64
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -target aarch64-linux-gnu -O2 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S %s -o %p/temp/codegen-aarch64-O2.s \
+// RUN: && grep -v -E '^[[:space:]]*(\.[a-z]|//)' %p/temp/codegen-aarch64-O2.s | FileCheck %s -check-prefix=A64
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -target aarch64-linux-gnu -O3 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S %s -o %p/temp/codegen-aarch64-O3.s \
+// RUN: && grep -v -E '^[[:space:]]*(\.[a-z]|//)' %p/temp/codegen-aarch64-O3.s | FileCheck %s -check-prefix=A64
+
+#include "stack_check.h"
+
+//
+// Cross-compilation for AArch64 (compile only): the check reads the thread pointer and the TLS field
+// without calls and without saving registers, compares it with the frame pointer x29,
+// and the failure path is placed out of line after the return of the function.
+// The registers and the order of the instructions depend on the clang version, so only these instructions are checked.
+//
+
+extern "C" void guarded_limit() { trust::stack_check::check_limit(); }
+
+// A64-LABEL: guarded_limit:
+// A64-NOT: {{bl |blr |stp x(19|2[0-8])|str x(19|2[0-8])}}
+// A64: mrs x{{[0-9]+}}, TPIDR_EL0
+// A64-NOT: {{bl |blr }}
+// A64: cmp {{x29, x[0-9]+|x[0-9]+, x29}}
+// A64-NEXT: b.{{lo|hi|hs|ls}} [[COLD:\.LBB[0-9_]+]]
+// A64-NOT: {{bl |blr }}
+// A64: ret
+// A64: {{^}}[[COLD]]:
+// A64: {{b|bl}} {{.*}}_ZN5trust11stack_check18check_limit_failedEv
+
+extern "C" void guarded_overflow() { trust::stack_check::check_overflow(1000); }
+
+// A64-LABEL: guarded_overflow:
+// A64-NOT: {{bl |blr |stp x(19|2[0-8])|str x(19|2[0-8])}}
+// A64: mrs x{{[0-9]+}}, TPIDR_EL0
+// A64-NOT: {{bl |blr }}
+// A64: add x{{[0-9]+}}, x{{[0-9]+}}, #1000
+// A64: cmp {{x29, x[0-9]+|x[0-9]+, x29}}
+// A64-NEXT: b.{{lo|hi|hs|ls}} [[COLD:\.LBB[0-9_]+]]
+// A64-NOT: {{bl |blr }}
+// A64: ret
+// A64: {{^}}[[COLD]]:
+// A64: {{b|bl}} {{.*}}_ZN5trust11stack_check21check_overflow_failedEm
+
+//
+// Checks injected by the plugin before the call of a function marked with an attribute.
+//
+
+int counter = 0;
+
+STACK_CHECK_SIZE(1000)
+[[gnu::noinline]] void guarded_callee() { counter += 1; }
+
+extern "C" void guarded_call() { guarded_callee(); }
+
+// A64-LABEL: guarded_call:
+// A64-NOT: {{stp x(19|2[0-8])|str x(19|2[0-8])}}
+// A64: cmp {{x29, x[0-9]+|x[0-9]+, x29}}
+// A64-NEXT: b.{{lo|hi|hs|ls}} [[COLD:\.LBB[0-9_]+]]
+// A64-NOT: {{stp x(19|2[0-8])|str x(19|2[0-8])}}
+// A64: {{b|bl}} {{.*}}_Z14guarded_calleev
+// A64: {{^}}[[COLD]]:
+// A64: bl {{.*}}_ZN5trust11stack_check21check_overflow_failedEm
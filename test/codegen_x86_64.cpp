@@ -0,0 +1,86 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -target x86_64-linux-gnu -O1 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S %s -o %p/temp/codegen-x86_64-O1.s \
+// RUN: && grep -v -E '^[[:space:]]*(\.[a-z]|#)' %p/temp/codegen-x86_64-O1.s | FileCheck %s -check-prefix=X86
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -target x86_64-linux-gnu -O2 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S %s -o %p/temp/codegen-x86_64-O2.s \
+// RUN: && grep -v -E '^[[:space:]]*(\.[a-z]|#)' %p/temp/codegen-x86_64-O2.s | FileCheck %s -check-prefix=X86
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -target x86_64-linux-gnu -O3 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so -Xclang -add-plugin -Xclang stack_check \
+// RUN: -S %s -o %p/temp/codegen-x86_64-O3.s \
+// RUN: && grep -v -E '^[[:space:]]*(\.[a-z]|#)' %p/temp/codegen-x86_64-O3.s | FileCheck %s -check-prefix=X86
+
+#include "stack_check.h"
+
+//
+// Code quality of the fast path of the checks at -O1, -O2 and -O3.
+// Assembler directives and comments are removed from the output, so the checks below
+// see only labels and instructions. The exact sequence depends on the register allocation, the TLS model
+// (local-exec or initial-exec for PIE) and the clang version, so only the constrained instructions are checked:
+// the TLS access without calls, one compare and one conditional branch to the failure path,
+// which is placed out of line after the return of the function.
+//
+
+extern "C" void guarded_limit() { trust::stack_check::check_limit(); }
+
+// X86-LABEL: guarded_limit:
+// X86-NOT: call
+// X86: {{%fs:|_ZN5trust11stack_check4infoE}}
+// X86-NOT: call
+// X86: cmpq
+// X86-NEXT: j{{b|ae|a|be}} [[COLD:\.LBB[0-9_]+]]
+// X86-NOT: {{^[[:space:]]*j(b|ae|a|be) }}
+// X86: retq
+// X86: {{^}}[[COLD]]:
+// X86: {{jmp|callq}} {{.*}}_ZN5trust11stack_check18check_limit_failedEv
+
+extern "C" void guarded_overflow() { trust::stack_check::check_overflow(1000); }
+
+// X86-LABEL: guarded_overflow:
+// X86-NOT: call
+// X86-DAG: {{%fs:|_ZN5trust11stack_check4infoE}}
+// X86-DAG: {{\$1000|1000\(}}
+// X86-NOT: call
+// X86: cmpq
+// X86-NEXT: j{{b|ae|a|be}} [[COLD:\.LBB[0-9_]+]]
+// X86-NOT: {{^[[:space:]]*j(b|ae|a|be) }}
+// X86: retq
+// X86: {{^}}[[COLD]]:
+// X86: {{jmp|callq}} {{.*}}_ZN5trust11stack_check21check_overflow_failedEm
+
+//
+// Checks injected by the plugin before the call of a function marked with an attribute.
+//
+
+int counter = 0;
+
+STACK_CHECK_SIZE(1000)
+[[gnu::noinline]] void guarded_callee() { counter += 1; }
+
+STACK_CHECK_LIMIT
+[[gnu::noinline]] void guarded_limit_callee() { counter += 2; }
+
+extern "C" void guarded_call() {
+    guarded_callee();
+    guarded_limit_callee();
+}
+
+// X86-LABEL: guarded_call:
+// X86-NOT: {{pushq %r[^b]|pushq %rbx|subq \$[0-9]+, %rsp|movq %[a-z0-9]+, -?[0-9]*\(%r[sb]p\)}}
+// X86: cmpq
+// X86-NEXT: j{{b|ae|a|be}} [[COLD1:\.LBB[0-9_]+]]
+// X86-NOT: {{pushq %r[^b]|pushq %rbx|subq \$[0-9]+, %rsp|movq %[a-z0-9]+, -?[0-9]*\(%r[sb]p\)}}
+// X86: callq {{.*}}_Z14guarded_calleev
+// X86-NOT: {{pushq %r[^b]|pushq %rbx|subq \$[0-9]+, %rsp|movq %[a-z0-9]+, -?[0-9]*\(%r[sb]p\)}}
+// X86: cmpq
+// X86-NEXT: j{{b|ae|a|be}} [[COLD2:\.LBB[0-9_]+]]
+// X86-NOT: {{pushq %r[^b]|pushq %rbx|subq \$[0-9]+, %rsp|movq %[a-z0-9]+, -?[0-9]*\(%r[sb]p\)}}
+// X86: {{callq|jmp}} {{.*}}_Z20guarded_limit_calleev
+// X86-DAG: {{^}}[[COLD1]]:
+// X86-DAG: {{^}}[[COLD2]]:
+// X86-DAG: {{callq|jmp}} {{.*}}_ZN5trust11stack_check21check_overflow_failedEm
+// X86-DAG: {{callq|jmp}} {{.*}}_ZN5trust11stack_check18check_limit_failedEv
+// X86: .Lfunc_end
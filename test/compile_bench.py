@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+#
+# Benchmark of the plugin compile time on a synthetic translation unit.
+#
+# The generated file contains the annotated functions and the callers with the specified number
+# of call sites in total. The file is compiled without the plugin and with the plugin,
+# and the difference in time is the cost of the check injection.
+#
+# Using: compile_bench.py [--sites 100000] [--callees 1000] [--opt -O0] [--clang clang++] [--plugin stack_check_clang.so]
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+
+def generate(path, sites, callees):
+    per_caller = 100
+    with open(path, "w") as out:
+        out.write('#include "stack_check.h"\n\n')
+        # Without the plugin, the attributes are not supported, and the functions are left unmarked
+        out.write("#ifdef BENCH_NO_PLUGIN\n#define BENCH_SIZE(size)\n#define BENCH_LIMIT\n")
+        out.write("#else\n#define BENCH_SIZE(size) STACK_CHECK_SIZE(size)\n#define BENCH_LIMIT STACK_CHECK_LIMIT\n#endif\n\n")
+        out.write("int counter = 0;\n\n")
+        for i in range(callees):
+            # Half of the functions are checked by the size and half by the limit
+            attr = "BENCH_SIZE({})".format(100 + i) if i % 2 == 0 else "BENCH_LIMIT"
+            out.write("{}\n[[gnu::noinline]] void callee_{}() {{ counter += {}; }}\n".format(attr, i, i))
+        out.write("\n")
+        for c in range((sites + per_caller - 1) // per_caller):
+            out.write("void caller_{}() {{\n".format(c))
+            for s in range(min(per_caller, sites - c * per_caller)):
+                out.write("    callee_{}();\n".format((c * per_caller + s) % callees))
+            out.write("}\n")
+        out.write("\nint main() { return counter; }\n")
+
+
+def compile_time(args, source, plugin):
+    cmd = [args.clang, "-std=c++20", "-I" + ROOT, args.opt, "-c", source, "-o", os.devnull]
+    if not plugin:
+        cmd.append("-DBENCH_NO_PLUGIN")
+    else:
+        cmd[1:1] = ["-Xclang", "-load", "-Xclang", args.plugin, "-Xclang", "-add-plugin", "-Xclang", "stack_check"]
+    start = time.perf_counter()
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    duration = time.perf_counter() - start
+    if result.returncode:
+        sys.stderr.write(result.stderr)
+        sys.exit("Compilation failed: " + " ".join(cmd))
+    return duration
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile time of the stack_check plugin on a synthetic TU")
+    parser.add_argument("--sites", type=int, default=100000, help="number of calls of the annotated functions")
+    parser.add_argument("--callees", type=int, default=1000, help="number of the annotated functions")
+    parser.add_argument("--opt", default="-O0", help="optimization level")
+    parser.add_argument("--clang", default="/usr/lib/llvm-21/bin/clang++", help="path to clang++")
+    parser.add_argument("--plugin", default=os.path.join(ROOT, "stack_check_clang.so"), help="path to the plugin")
+    args = parser.parse_args()
+
+    if args.sites <= 0 or args.callees <= 0:
+        sys.exit("The number of call sites and functions must be greater than zero.")
+
+    with tempfile.TemporaryDirectory() as tmp:
+        source = os.path.join(tmp, "compile_bench.cpp")
+        generate(source, args.sites, args.callees)
+
+        without_plugin = compile_time(args, source, False)
+        with_plugin = compile_time(args, source, True)
+
+    print("Call sites: {}, annotated functions: {}, {}".format(args.sites, args.callees, args.opt))
+    print("Without plugin: {:.3f} sec".format(without_plugin))
+    print("With plugin:    {:.3f} sec".format(with_plugin))
+    print("Plugin overhead: {:.3f} sec ({:.1f}%)".format(with_plugin - without_plugin,
+                                                       (with_plugin - without_plugin) * 100.0 / without_plugin))
+
+
+if __name__ == "__main__":
+    main()
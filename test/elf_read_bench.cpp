@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+/*
+ * Startup benchmark for reading the `.stack_sizes` section.
+ *
+ * The time to build the stack sizes index of a real ELF file compiled with `-fstack-size-section`
+ * (by default, the benchmark itself) is measured when the whole file is mapped into memory (MappedELF)
+ * and when only the required parts are read (ReadELF). The difference grows with the size of the file,
+ * so it is meaningful for large binaries with debug information, e.g. the unit tests built with `-g -O0`
+ * (the `elf-read-bench-run` target), where the debug sections make up most of the file.
+ */
+
+template <typename Reader> size_t measure(const std::string &path, size_t iterations, size_t &functions) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        StackSizesSection section{Reader(path.c_str())};
+        functions = section.entries.size();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "Using: elf_read_bench [elf_file] [iterations]\nBy default, the benchmark itself and 100 iterations are used."
+                  << std::endl;
+        return 1;
+    }
+
+    std::string path = argc > 1 ? argv[1] : "/proc/self/exe";
+    size_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+    if (!iterations) {
+        iterations = 1;
+    }
+
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+        std::cerr << "Error: file '" << path << "' not found" << std::endl;
+        return 1;
+    }
+
+    size_t mapped_functions = 0;
+    size_t read_functions = 0;
+    size_t mapped_time = measure<MappedELF>(path, iterations, mapped_functions);
+    size_t read_time = measure<ReadELF>(path, iterations, read_functions);
+
+    std::cout << "File: " << path << ", size: " << st.st_size / 1024 << " KB, functions: " << read_functions << std::endl;
+    std::cout << "MappedELF (mmap of the entire file): " << mapped_time << " microsecs" << std::endl;
+    std::cout << "ReadELF (pread of the required parts): " << read_time << " microsecs" << std::endl;
+
+    if (mapped_functions != read_functions) {
+        std::cerr << "Error: different number of functions " << mapped_functions << " and " << read_functions << std::endl;
+        return 1;
+    }
+    return 0;
+}
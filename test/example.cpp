@@ -5,8 +5,6 @@
 
 using namespace trust;
 
-const thread_local stack_check stack_check::info;
-
 // Функция без автоматической проверки стека от переполнения
 int func() { return 0; }
 
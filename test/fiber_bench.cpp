@@ -0,0 +1,172 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <ucontext.h>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+/*
+ * Benchmark of checks on the stacks of fibers (user-mode contexts).
+ *
+ * Many fibers with small stacks are created, and the scheduler switches between them in a round-robin.
+ * At each step, the fiber performs a recursive call of the specified depth and returns control to the scheduler.
+ * The time is measured without checks and with checks, when the stack parameters are installed
+ * by calling stack_check::switch_stack on each context switch.
+ */
+
+struct Fiber {
+    std::unique_ptr<char[]> stack;
+    ucontext_t ctx;
+    stack_check info;
+};
+
+static ucontext_t sched_ctx;
+static stack_check sched_info;
+static Fiber *current = nullptr;
+
+static bool use_checks = false;
+static size_t rounds = 0;
+static size_t depth = 0;
+static size_t call_depth = 0;
+
+void TrustRecursion(size_t depth) {
+    call_depth++;
+    if (!depth) {
+        return;
+    }
+    stack_check::check_overflow(4500);
+    if (call_depth > 1'000'000'000) {
+        std::cout << "Oops. Very good optimization!\n";
+        return;
+    }
+    TrustRecursion(depth - 1);
+    // Prevents the recursion from being converted into a loop
+    asm volatile("");
+}
+
+void UntrustRecursion(size_t depth) {
+    call_depth++;
+    if (!depth) {
+        return;
+    }
+    if (call_depth > 1'000'000'000) {
+        std::cout << "Oops. Very good optimization!\n";
+        return;
+    }
+    UntrustRecursion(depth - 1);
+    // Prevents the recursion from being converted into a loop
+    asm volatile("");
+}
+
+// Returning control to the scheduler
+static void yield() {
+    if (use_checks) {
+        stack_check::switch_stack(sched_info, &current->info);
+    }
+    swapcontext(&current->ctx, &sched_ctx);
+}
+
+static void fiber_func() {
+    for (size_t i = 0; i < rounds; i++) {
+        if (use_checks) {
+            TrustRecursion(depth);
+        } else {
+            UntrustRecursion(depth);
+        }
+        yield();
+    }
+    // The fiber is completed, and the scheduler continues via uc_link
+    if (use_checks) {
+        stack_check::switch_stack(sched_info);
+    }
+}
+
+static void fiber_overflow() {
+    try {
+        TrustRecursion(-1);
+    } catch (stack_overflow &info) {
+        std::cout << "Stack overflow in the fiber is caught at the call depth " << call_depth << std::endl;
+    }
+    stack_check::switch_stack(sched_info);
+}
+
+static void init_fiber(Fiber &fiber, size_t stack_size, void (*func)()) {
+    fiber.stack.reset(new char[stack_size]);
+    fiber.info = stack_check(fiber.stack.get(), stack_size);
+    getcontext(&fiber.ctx);
+    fiber.ctx.uc_stack.ss_sp = fiber.stack.get();
+    fiber.ctx.uc_stack.ss_size = stack_size;
+    fiber.ctx.uc_link = &sched_ctx;
+    makecontext(&fiber.ctx, func, 0);
+}
+
+// Switching to the fiber
+static void resume(Fiber &fiber) {
+    current = &fiber;
+    if (use_checks) {
+        stack_check::switch_stack(fiber.info, &sched_info);
+    }
+    swapcontext(&sched_ctx, &fiber.ctx);
+}
+
+static size_t run(size_t count, size_t stack_size, bool checks) {
+    use_checks = checks;
+    std::vector<Fiber> fibers(count);
+    for (auto &fiber : fibers) {
+        init_fiber(fiber, stack_size, fiber_func);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    // The last round completes the fiber functions
+    for (size_t i = 0; i <= rounds; i++) {
+        for (auto &fiber : fibers) {
+            resume(fiber);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 4) {
+        std::cerr << "Using: fiber_bench [fibers] [rounds] [depth]\nBy default, 1000 fibers with 64 KiB stacks, 100 rounds and "
+                     "a call depth of 100 are used."
+                  << std::endl;
+        return 1;
+    }
+
+    const size_t stack_size = 64 * 1024;
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+    depth = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100;
+    if (!count || !rounds) {
+        std::cerr << "The number of fibers and rounds must be greater than zero." << std::endl;
+        return 1;
+    }
+
+    size_t switches = count * (rounds + 1) * 2;
+    size_t untrust_time = run(count, stack_size, false);
+    size_t trust_time = run(count, stack_size, true);
+
+    std::cout << "Fibers: " << count << ", stack size: " << stack_size << ", context switches: " << switches << std::endl;
+    std::cout << "Without checks:                 " << untrust_time << " nanosecs (" << untrust_time / switches << " per switch)"
+              << std::endl;
+    std::cout << "With checks and switch_stack:   " << trust_time << " nanosecs (" << trust_time / switches << " per switch)"
+              << std::endl;
+    std::cout << "Stack overflow protection in fibers reduces speed: " << (trust_time - (double)untrust_time) * 100.0 / untrust_time
+              << "%" << std::endl;
+
+    // Overflow of a small fiber stack is detected by the checks
+    use_checks = true;
+    call_depth = 0;
+    Fiber fiber;
+    init_fiber(fiber, stack_size, fiber_overflow);
+    resume(fiber);
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O1 -fno-inline \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang verbose \
+// RUN: -S -emit-llvm %s -o %p/temp/hoist-O1.ll > %p/temp/hoist-O1.out \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/hoist-O1.ll \
+// RUN: && FileCheck %s -check-prefix=OUT < %p/temp/hoist-O1.out
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O1 -fno-inline \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-hoist \
+// RUN: -S -emit-llvm %s -o %p/temp/hoist-no-O1.ll \
+// RUN: && FileCheck %s -check-prefix=NO < %p/temp/hoist-no-O1.ll
+
+#include "stack_check.h"
+
+// Чтобы вызовы проверок были видны в IR, они не раскрываются плагином (no-inline)
+// и не встраиваются оптимизатором (-fno-inline)
+
+int counter = 0;
+
+STACK_CHECK_SIZE(100)
+[[gnu::noinline]] void loop_frame() { counter += 1; }
+
+STACK_CHECK_LIMIT
+[[gnu::noinline]] void loop_limit() { counter += 2; }
+
+// The check of a call executed on each iteration before the loop can exit is moved before the loop
+void loop(size_t count) {
+    size_t i = 0;
+    do {
+        loop_frame();
+    } while (++i < count);
+}
+
+// IR-LABEL: define {{.*}}void @_Z4loopm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NOT: @_ZN5trust11stack_check14check_overflowEm
+// IR: call void @_Z10loop_framev()
+// IR-NOT: @_ZN5trust11stack_check14check_overflowEm
+// IR: {{^}}}
+
+// NO-LABEL: define {{.*}}void @_Z4loopm(
+// NO: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// NO-NEXT: call void @_Z10loop_framev()
+
+// In nested loops, the check is moved before the outermost loop
+void nested(size_t count) {
+    size_t j = 0;
+    do {
+        size_t i = 0;
+        do {
+            loop_limit();
+        } while (++i < count);
+    } while (++j < count);
+}
+
+// IR-LABEL: define {{.*}}void @_Z6nestedm(
+// IR: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NOT: @_ZN5trust11stack_check11check_limitEv
+// IR: call void @_Z10loop_limitv()
+// IR-NOT: @_ZN5trust11stack_check11check_limitEv
+// IR: {{^}}}
+
+// The header of the loop exits before the call (the loop may run zero times), so the check stays in the loop
+void zero_trip(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        loop_frame();
+    }
+}
+
+// IR-LABEL: define {{.*}}void @_Z9zero_tripm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z10loop_framev()
+
+// Defined in another translation unit, so it may throw or not return
+void opaque_call();
+
+// The check is not moved before a call that may throw or not return
+void opaque_loop(size_t count) {
+    size_t i = 0;
+    do {
+        opaque_call();
+        loop_frame();
+    } while (++i < count);
+}
+
+// IR-LABEL: define {{.*}}void @_Z11opaque_loopm(
+// IR: call void @_Z11opaque_callv()
+// IR-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z10loop_framev()
+
+// The check of a call on a conditional path of the loop body stays in the loop
+void conditional(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (i & 1) {
+            loop_frame();
+        }
+    }
+}
+
+// IR-LABEL: define {{.*}}void @_Z11conditionalm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z10loop_framev()
+
+// A dynamic alloca moves the stack pointer, so the check stays in the loop
+void dynamic(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char *buffer = static_cast<char *>(__builtin_alloca(count));
+        buffer[0] = 0;
+        loop_frame();
+    }
+}
+
+// IR-LABEL: define {{.*}}void @_Z7dynamicm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 {{.*}}100)
+// IR-NEXT: call void @_Z10loop_framev()
+
+// OUT: verbose: Hoisted 1 of 1 stack checks out of loops in _Z4loopm
+// OUT: verbose: Hoisted 1 of 1 stack checks out of loops in _Z6nestedm
+// OUT-NOT: _Z9zero_tripm
+// OUT-NOT: _Z11opaque_loopm
+// OUT-NOT: _Z11conditionalm
+// OUT-NOT: _Z7dynamicm
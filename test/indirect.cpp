@@ -0,0 +1,129 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O0 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang verbose \
+// RUN: -S -emit-llvm %s -o %p/temp/indirect-O0.ll > %p/temp/indirect-O0.out \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/indirect-O0.ll \
+// RUN: && FileCheck %s -check-prefix=OUT < %p/temp/indirect-O0.out
+
+#include "stack_check.h"
+
+// Возможные цели косвенного вызова - отмеченные функции модуля с тем же типом, адрес которых берётся,
+// а для виртуального вызова - функции из той же ячейки таблиц виртуальных функций,
+// и проверка выполняется для наихудшего случая
+
+int counter = 0;
+
+struct Visitor {
+    virtual void visit(int depth) = 0;
+    virtual ~Visitor() = default;
+    virtual void leave(int depth) { counter -= depth * 5; }
+};
+
+struct SmallVisitor : Visitor {
+    STACK_CHECK_SIZE(100)
+    void visit(int depth) override { counter += depth; }
+};
+
+struct LargeVisitor : Visitor {
+    STACK_CHECK_SIZE(500)
+    void visit(int depth) override { counter -= depth; }
+};
+
+struct LimitVisitor : Visitor {
+    STACK_CHECK_LIMIT
+    void visit(int depth) override { counter ^= depth; }
+};
+
+// The virtual call is checked with the maximum size and the limit of all overriders,
+// but not with the size of visit_callback below, which has the same type
+void dispatch(Visitor &visitor, int depth) { visitor.visit(depth); }
+
+// IR-LABEL: define {{.*}}void @_Z8dispatchR7Visitori(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 500)
+// IR-NEXT: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call void %{{[0-9]+}}(
+// IR: {{^}}}
+
+// Another virtual method of the same type is in another slot of the vtables, so the call is not checked
+void dispatch_leave(Visitor &visitor, int depth) { visitor.leave(depth); }
+
+// IR-LABEL: define {{.*}}void @_Z14dispatch_leaveR7Visitori(
+// IR-NOT: @_ZN5trust11stack_check
+// IR: {{^}}}
+
+// The slot of a member function pointer is not known, so the call is checked for all functions in the vtables of the type,
+// and its non-virtual branch for the functions of the type whose address is taken
+void call_member(Visitor &visitor, void (Visitor::*method)(int), int depth) { (visitor.*method)(depth); }
+
+// IR-LABEL: define {{.*}}void @_Z11call_member
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 800)
+// IR-NEXT: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call void %{{[0-9]+}}(
+// IR: {{^}}}
+
+// The function has the same type as the overriders, but it is not in the vtables, so the virtual calls are not checked for it
+STACK_CHECK_SIZE(800)
+void visit_callback(Visitor *, int depth) { counter += depth * 6; }
+
+// The overriders are referenced only from the vtables, so the call through a pointer of the same type
+// is checked only for the function whose address is taken
+void call_callback(void (*func)(Visitor *, int), Visitor *visitor, int depth) { func(visitor, depth); }
+
+// IR-LABEL: define {{.*}}void @_Z13call_callback
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 800)
+// IR-NOT: check_limit
+// IR: call void %{{[0-9]+}}(
+// IR: {{^}}}
+
+STACK_CHECK_SIZE(200)
+void handler(int depth) { counter += depth * 2; }
+
+void plain_handler(int depth) { counter += depth * 3; }
+
+// The function is called only directly, so it is not a target of the calls through a pointer
+STACK_CHECK_SIZE(900)
+void direct_only(int depth) { counter += depth * 4; }
+
+void long_handler(long depth) { counter += depth; }
+
+// The call through a pointer is checked with the size of the annotated function of the same type
+void call_pointer(void (*func)(int), int depth) { func(depth); }
+
+// IR-LABEL: define {{.*}}void @_Z12call_pointerPFviEi(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 200)
+// IR-NEXT: call void %{{[0-9]+}}(
+// IR: {{^}}}
+
+// There are no annotated functions of this type, so the call is not checked
+void call_long(void (*func)(long), long depth) { func(depth); }
+
+// IR-LABEL: define {{.*}}void @_Z9call_longPFvlEl(
+// IR-NOT: @_ZN5trust11stack_check
+// IR: {{^}}}
+
+int main() {
+    SmallVisitor small;
+    LargeVisitor large;
+    LimitVisitor limit;
+    dispatch(small, 1);
+    dispatch(large, 2);
+    dispatch(limit, 3);
+    dispatch_leave(small, 8);
+    call_member(large, &Visitor::visit, 9);
+    call_callback(visit_callback, &limit, 10);
+
+    call_pointer(handler, 4);
+    call_pointer(plain_handler, 5);
+    direct_only(6);
+    call_long(long_handler, 7);
+    return 0;
+}
+
+// OUT: verbose: Inject the worst-case check of the indirect call in _Z8dispatchR7Visitori
+// OUT-NOT: indirect call in _Z14dispatch_leaveR7Visitori
+// OUT: verbose: Inject the worst-case check of the indirect call in _Z11call_member
+// OUT: verbose: Inject the worst-case check of the indirect call in _Z13call_callback
+// OUT: verbose: Inject the worst-case check of the indirect call in _Z12call_pointerPFviEi
+// OUT-NOT: indirect call in _Z9call_longPFvlEl
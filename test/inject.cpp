@@ -36,12 +36,12 @@ class TestClass {
 const thread_local trust::stack_check info;
 
 size_t inplace_code(size_t size) {
-    if (static_cast<char *>(__builtin_frame_address(0)) < (static_cast<char *>(info.bottom) + size)) {
+    if (reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) < info.bottom + size) {
         trust::stack_check::throw_stack_overflow(size, info);
     }
 
     // No need for addition operator before comparison and more opportunities for optimization
-    if (static_cast<char *>(__builtin_frame_address(0)) < (static_cast<char *>(info.bottom_limit))) {
+    if (reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) < info.bottom_limit) {
         trust::stack_check::throw_stack_overflow(info.limit, info);
     }
     return size;
@@ -75,24 +75,42 @@ int main() {
     // now it is necessary to automatically insert the code to check for free space in the stack.
 
     inject_function();
-    // O0-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 100)
-    // O0-NEXT: call void @_Z15inject_functionv()
+    // The check is expanded inline: the frame address is compared with the lower bound of the stack.
+    // O0-NEXT: [[FRAME1:%[0-9]+]] = call ptr @llvm.frameaddress.p0(i32 0)
+    // O0-NEXT: [[ADDR1:%[0-9]+]] = ptrtoint ptr [[FRAME1]] to i64
+    // O0-NEXT: [[INFO1:%[0-9]+]] = call {{.*}}ptr @llvm.threadlocal.address.p0(ptr {{.*}}@_ZN5trust11stack_check4infoE)
+    // O0-NEXT: [[BOTTOM1:%[0-9]+]] = load i64, ptr [[INFO1]]
+    // O0-NEXT: [[BOUND1:%[0-9]+]] = add i64 [[BOTTOM1]], 100
+    // O0-NEXT: [[COND1:%[0-9]+]] = icmp ult i64 [[ADDR1]], [[BOUND1]]
+    // O0-NEXT: br i1 [[COND1]], label %[[COLD1:[0-9]+]], label %{{[0-9]+}}, !prof [[UNLIKELY:![0-9]+]]
+    // O0-NOT: call
+    // O0: call void @_Z15inject_functionv()
 
     // The function call is converted into inline code by the optimizer.
     // COM: O3-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 100)
     // O3: call void @_Z15inject_functionv()
 
     inject_limit();
-    // O0-NEXT: call void @_ZN5trust11stack_check11check_limitEv()
-    // O0-NEXT: call void @_Z12inject_limitv()
+    // O0-NEXT: [[FRAME2:%[0-9]+]] = call ptr @llvm.frameaddress.p0(i32 0)
+    // O0-NEXT: [[ADDR2:%[0-9]+]] = ptrtoint ptr [[FRAME2]] to i64
+    // O0-NEXT: [[INFO2:%[0-9]+]] = call {{.*}}ptr @llvm.threadlocal.address.p0(ptr {{.*}}@_ZN5trust11stack_check4infoE)
+    // O0-NEXT: [[LIMIT2:%[0-9]+]] = getelementptr inbounds {{.*}}, ptr [[INFO2]], i32 0, i32 1
+    // O0-NEXT: [[BOUND2:%[0-9]+]] = load i64, ptr [[LIMIT2]]
+    // O0-NEXT: [[COND2:%[0-9]+]] = icmp ult i64 [[ADDR2]], [[BOUND2]]
+    // O0-NEXT: br i1 [[COND2]], label %[[COLD2:[0-9]+]], label %{{[0-9]+}}, !prof [[UNLIKELY]]
+    // O0-NOT: call
+    // O0: call void @_Z12inject_limitv()
 
     // The function call is converted into inline code by the optimizer.
     // COM: O3-NEXT: call void @_ZN5trust11stack_check11check_limitEv()
     // O3: call void @_Z12inject_limitv()
 
     TestClass::inject_method();
-    // O0-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 99)
-    // O0-NEXT: call void @_ZN9TestClass13inject_methodEv()
+    // O0-NEXT: [[FRAME3:%[0-9]+]] = call ptr @llvm.frameaddress.p0(i32 0)
+    // O0: add i64 {{.*}}, 99
+    // O0: br i1 {{.*}}, label %[[COLD3:[0-9]+]], label %{{[0-9]+}}, !prof [[UNLIKELY]]
+    // O0-NOT: call
+    // O0: call void @_ZN9TestClass13inject_methodEv()
 
     // The function call is converted into inline code by the optimizer.
     // COM: O3-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 99)
@@ -100,3 +118,14 @@ int main() {
 
     return 0;
 }
+
+// The slow paths of the checks are placed at the end of the function.
+// O0: {{^}}[[COLD1]]:
+// O0-NEXT: call void @_ZN5trust11stack_check21check_overflow_failedEm(i64 100)
+// O0: {{^}}[[COLD2]]:
+// O0-NEXT: call void @_ZN5trust11stack_check18check_limit_failedEv()
+// O0: {{^}}[[COLD3]]:
+// O0-NEXT: call void @_ZN5trust11stack_check21check_overflow_failedEm(i64 99)
+// O0: {{^}}}
+
+// O0: [[UNLIKELY]] = !{!"branch_weights", {{.*}}i32 1, i32 {{[0-9]+}}}
@@ -9,7 +9,7 @@ config.test_format = lit.formats.ShTest(not lit_config.useValgrind)
 
 # Настройки тестов
 config.suffixes = ['.c', '.cpp']
-config.excludes = ['unit_test.cpp', 'unit2_test.cpp', 'speed_test.cpp', 'prime_check.cpp']
+config.excludes = ['unit_test.cpp', 'unit2_test.cpp', 'speed_test.cpp', 'prime_check.cpp', 'elf_read_bench.cpp', 'fiber_bench.cpp', 'throw_bench.cpp', 'loop_bench.cpp', 'callers_bench.cpp', 'speed_test_main.cpp', 'stack_sizes_lib.cpp']
 
 # Пути к инструментам
 config.llvm_tools_dir = "/usr/lib/llvm-21/bin"
@@ -22,5 +22,14 @@ config.environment['PATH'] = os.path.pathsep.join((
 
 # Доступные функции и подстановки
 config.available_features.add('clang')
+
+# Кросс-компиляция для AArch64 (только компиляция, без запуска)
+if os.path.isdir('/usr/aarch64-linux-gnu/include'):
+    config.available_features.add('aarch64-sysroot')
+
+# Сбор профиля PGO для теста размещения проверок по профилю
+if os.path.exists(os.path.join(config.llvm_tools_dir, 'llvm-profdata')):
+    config.available_features.add('llvm-profdata')
+
 config.substitutions.append(('%shlibdir', os.path.join(os.path.dirname(__file__), "..")))
 config.substitutions.append(('%clangxx', os.path.join(config.llvm_tools_dir, 'clang++')))
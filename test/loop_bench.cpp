@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+/*
+ * Benchmark of a guarded call in a tight loop.
+ *
+ * The program is compiled with the stack_check plugin, which injects a check before each call
+ * of the guarded function. The loop with the guarded function is compared with the same loop
+ * calling a function without the attribute. With hoisting of checks out of loops (by default when optimizing),
+ * the check is executed once before the loop, and with the `no-hoist` plugin argument on each iteration.
+ * The loops run at least once (`do` ... `while`), since a check is not hoisted out of a loop that may run zero times.
+ * Without optimization, the check is executed on each iteration, and the inline check expanded by the plugin
+ * is compared with the call of the check function (the `no-inline` plugin argument).
+ */
+
+size_t counter = 0;
+
+STACK_CHECK_SIZE(1000)
+[[gnu::noinline]] void guarded_step(size_t i) {
+    counter += i;
+    // Prevents the calls from being removed or merged
+    asm volatile("");
+}
+
+[[gnu::noinline]] void plain_step(size_t i) {
+    counter += i;
+    // Prevents the calls from being removed or merged
+    asm volatile("");
+}
+
+[[gnu::noinline]] size_t guarded_loop(size_t iterations) {
+    size_t i = 0;
+    do {
+        guarded_step(i);
+    } while (++i < iterations);
+    return counter;
+}
+
+[[gnu::noinline]] size_t plain_loop(size_t iterations) {
+    size_t i = 0;
+    do {
+        plain_step(i);
+    } while (++i < iterations);
+    return counter;
+}
+
+template <typename Func> size_t measure(size_t iterations, Func func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    func(iterations);
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        std::cerr << "Using: loop_bench [iterations]\nBy default, 500000000 iterations are used." << std::endl;
+        return 1;
+    }
+
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500'000'000;
+    if (!iterations) {
+        iterations = 1;
+    }
+
+    // The stack parameters of the thread are queried before the measurement
+    stack_check::init_thread();
+
+    size_t plain_time = measure(iterations, plain_loop);
+    size_t guarded_time = measure(iterations, guarded_loop);
+
+    std::cout << "Iterations: " << iterations << std::endl;
+    std::cout << "Calls without checks:  " << plain_time << " nanosecs" << std::endl;
+    std::cout << "Guarded calls:         " << guarded_time << " nanosecs" << std::endl;
+    std::cout << "Stack overflow checks in the loop reduce speed: " << (guarded_time - (double)plain_time) * 100.0 / plain_time << "%"
+              << std::endl;
+
+    return 0;
+}
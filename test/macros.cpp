@@ -1,6 +1,6 @@
 // RUN: not %clangxx -I%shlibdir -std=c++20 -fsyntax-only %s 2>&1 | FileCheck %s -check-prefix=OFF
 
-// RUN: not %clangxx -I%shlibdir -std=c++20 -fsyntax-only \
+// RUN: %clangxx -I%shlibdir -std=c++20 -fsyntax-only \
 // RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
 // RUN: -Xclang -add-plugin -Xclang stack_check \
 // RUN: -Xclang -plugin-arg-stack_check -Xclang verbose  %s 2>&1  \
@@ -13,7 +13,9 @@
 STACK_CHECK_SIZE(0)
 void correct_function() {
     // OFF: error:
-    // ON: error: I couldn't find a way to call MachineFunctionPass from an AST
+    // The frame size is determined automatically from the .stack_sizes section
+    // ON-NOT: error
+    // ON: verbose: Enable the .stack_sizes section for the automatic frame size
     // ON: verbose: Apply attr 'stack_check_size' to correct_function
 }
 
@@ -0,0 +1,77 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O0 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang 'include=parser::*' \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang 'exclude=*::fast_*' \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang verbose \
+// RUN: -S -emit-llvm %s -o %p/temp/name-mask-O0.ll > %p/temp/name-mask-O0.out \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/name-mask-O0.ll \
+// RUN: && FileCheck %s -check-prefix=OUT < %p/temp/name-mask-O0.out
+
+// RUN: not %clangxx -I%shlibdir -std=c++20 -fsyntax-only \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang 'include=parser::[' \
+// RUN: %s 2>&1 | FileCheck %s -check-prefix=ERROR
+
+#include "stack_check.h"
+
+// Функции без атрибутов выбираются маской имени после деманглинга, а маска исключения отключает и проверки атрибутов
+
+int counter = 0;
+
+namespace parser {
+
+// Declared only, like a function of a third-party library
+void parse_external(int depth);
+
+void parse(int depth) { counter += depth; }
+
+// The attribute is kept for a function that is also matched by the include mask
+STACK_CHECK_SIZE(300)
+void parse_block(int depth) { counter -= depth; }
+
+// The exclude mask removes the check of the attribute
+STACK_CHECK_SIZE(200)
+void fast_skip(int depth) { counter ^= depth; }
+
+// The demangled name of a template function starts with the return type, which is skipped when matching the mask
+template <typename T> T parse_value(T depth) { return depth + 1; }
+
+} // namespace parser
+
+void other(int depth) { counter += depth * 2; }
+
+void run(int depth) {
+    parser::parse(depth);
+    parser::parse_block(depth);
+    parser::parse_external(depth);
+    parser::fast_skip(depth);
+    other(depth);
+    counter += parser::parse_value(depth);
+}
+
+// IR-LABEL: define {{.*}}void @_Z3runi(
+// IR: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call void @_ZN6parser5parseEi(
+// IR-NEXT: call void @_ZN5trust11stack_check14check_overflowEm(i64 300)
+// IR-NEXT: call void @_ZN6parser11parse_blockEi(
+// IR-NEXT: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call void @_ZN6parser14parse_externalEi(
+// IR-NEXT: call void @_ZN6parser9fast_skipEi(
+// IR-NEXT: call void @_Z5otheri(
+// IR: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call noundef i32 @_ZN6parser11parse_valueIiEET_S1_(
+// IR: {{^}}}
+
+// OUT: Protect the functions by the name mask 'parser::*'
+// OUT: Exclude the functions by the name mask '*::fast_*'
+// OUT-DAG: verbose: Protect parser::parse(int) by the mask 'parser::*'
+// OUT-DAG: verbose: Protect parser::parse_external(int) by the mask 'parser::*'
+// OUT-DAG: verbose: Exclude parser::fast_skip(int) by the mask '*::fast_*'
+// OUT-DAG: verbose: Protect parser::parse_value<int>(int) by the mask 'parser::*'
+// OUT-NOT: verbose: Protect other(int)
+// OUT-NOT: verbose: Protect parser::parse_block(int)
+
+// ERROR: Invalid name mask in the plugin argument: 'include=parser::['
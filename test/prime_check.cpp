@@ -2,14 +2,13 @@
 #include <cstdlib>
 #include <gmpxx.h>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "stack_check.h"
 
 using namespace trust;
 
-const thread_local trust::stack_check trust::stack_check::info;
-
 // Глобальные переменные для отслеживания глубины рекурсии и количества вызовов
 int currentDepth = 0;
 int maxDepth = 0;
@@ -67,6 +66,10 @@ bool isPrime(const mpz_class &n, const mpz_class &divisor = 2) {
 // Рекурсивная функция для проверки, является ли число простым
 // n - проверяемое число
 // divisor - текущий делитель, с которого начинаем проверку
+#ifdef PRIME_CHECK_PLUGIN
+// Проверку вставляет плагин: перед каждым вызовом функции или в её начало (аргумент плагина prologue)
+STACK_CHECK_SIZE(10000)
+#endif
 bool isPrimeSafe(const mpz_class &n, const mpz_class &divisor = 2) {
     // Увеличиваем счетчик вызовов
     callCount_safe++;
@@ -101,7 +104,9 @@ bool isPrimeSafe(const mpz_class &n, const mpz_class &divisor = 2) {
     }
 
     // Рекурсивный вызов с увеличенным делителем
+#ifndef PRIME_CHECK_PLUGIN
     stack_check::check_overflow(10000);
+#endif
     bool result = isPrimeSafe(n, divisor + 1);
 
     // Уменьшаем текущую глубину рекурсии при возврате
@@ -113,7 +118,7 @@ bool isPrimeSafe(const mpz_class &n, const mpz_class &divisor = 2) {
 int main(int argc, char *argv[]) {
     // Проверяем, что передан хотя бы один аргумент командной строки
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <start_number> [count]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <start_number> [count] [guard]" << std::endl;
         return 1;
     }
 
@@ -151,6 +156,16 @@ int main(int argc, char *argv[]) {
         count = static_cast<int>(countArg);
     }
 
+    // Режим без проверок при вызове, переполнение стека определяется по странице защиты
+    bool guard = false;
+    if (argc >= 4) {
+        if (std::string(argv[3]) != "guard") {
+            std::cerr << "Error: Invalid mode (only 'guard' is supported)" << std::endl;
+            return 1;
+        }
+        guard = true;
+    }
+
     std::vector<mpz_class> output;
     output.reserve(count);
 
@@ -173,10 +188,10 @@ int main(int argc, char *argv[]) {
 
     // } catch (stack_overflow &stack) {
     //     std::cout << "Stack overflow exception at: " << maxDepth_safe << " call depth." << std::endl;
-    //     std::cout << "Stack top: " << stack_check::info.top << " bottom: " << stack_check::info.bottom
+    //     std::cout << "Stack top: " << stack_check::info.top << " bottom: " << (void *)stack_check::info.bottom
     //               << " (stack size: " << stack_check::get_stack_size() << ")" << std::endl;
     //     std::cout << "Query size: " << stack.m_size << " end frame: " << stack.info->frame
-    //               << " (free space: " << (static_cast<char *>(stack.info->frame) - static_cast<char *>(stack_check::info.bottom)) << ")"
+    //               << " (free space: " << (static_cast<char *>(stack.info->frame) - reinterpret_cast<char *>(stack_check::info.bottom)) << ")"
     //               << std::endl;
     //     return 1;
     // }
@@ -205,10 +220,10 @@ int main(int argc, char *argv[]) {
 
     } catch (stack_overflow &stack) {
         std::cout << "Stack overflow exception at: " << maxDepth_safe << " call depth." << std::endl;
-        std::cout << "Stack top: " << stack_check::info.top << " bottom: " << stack_check::info.bottom
+        std::cout << "Stack top: " << stack_check::info.top << " bottom: " << (void *)stack_check::info.bottom
                   << " (stack size: " << stack_check::get_stack_size() << ")" << std::endl;
         std::cout << "Query size: " << stack.size << " end frame: " << stack.info->frame
-                  << " (free space: " << (static_cast<char *>(stack.info->frame) - static_cast<char *>(stack_check::info.bottom)) << ")"
+                  << " (free space: " << (static_cast<char *>(stack.info->frame) - reinterpret_cast<char *>(stack_check::info.bottom)) << ")"
                   << std::endl;
         return 1;
     }
@@ -235,16 +250,32 @@ int main(int argc, char *argv[]) {
     foundCount = 0;
     number = startNumber;
 
-    while (foundCount < count) {
-        bool isNumberPrime = isPrime(number);
+    auto find_primes = [&]() {
+        while (foundCount < count) {
+            bool isNumberPrime = isPrime(number);
 
-        // Выводим простые числа
-        if (isNumberPrime) {
-            output.push_back(number);
-            foundCount++;
-        }
+            // Выводим простые числа
+            if (isNumberPrime) {
+                output.push_back(number);
+                foundCount++;
+            }
 
-        number++;
+            number++;
+        }
+    };
+
+    if (guard) {
+        // При переполнении кадры isPrime отбрасываются без деструкторов, поэтому память временных mpz_class теряется,
+        // а если ошибка произошла внутри GMP или malloc (не async-signal-safe), их блокировки и куча могут остаться
+        // в несогласованном состоянии: после исключения программа только выводит сообщение и завершается
+        try {
+            stack_guard::call(find_primes);
+        } catch (stack_overflow &stack) {
+            std::cout << "Stack overflow on the guard page at: " << maxDepth << " call depth." << std::endl;
+            return 1;
+        }
+    } else {
+        find_primes();
     }
 
     // Засекаем время окончания выполнения
@@ -266,9 +297,10 @@ int main(int argc, char *argv[]) {
     std::cout << "\n";
 
     // Выводим максимальную глубину рекурсии, количество вызовов и время выполнения
-    std::cout << "Max recursion depth: " << maxDepth << std::endl;
-    std::cout << "Number of recursive calls: " << callCount << std::endl;
-    std::cout << "Execution time: " << duration.count() << " microseconds" << std::endl;
+    const char *mode = guard ? " GUARD" : "";
+    std::cout << "Max recursion depth" << mode << ": " << maxDepth << std::endl;
+    std::cout << "Number of recursive calls" << mode << ": " << callCount << std::endl;
+    std::cout << "Execution time" << mode << ": " << duration.count() << " microseconds" << std::endl;
 
     std::cout << "Difference in execution time: " << 100.0 * (duration_safe.count() - duration.count()) / duration.count() << " %"
               << std::endl;
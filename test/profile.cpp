@@ -0,0 +1,114 @@
+// REQUIRES: llvm-profdata
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -fprofile-instr-generate \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: %s -o %p/temp/profile-gen
+// RUN: env LLVM_PROFILE_FILE=%p/temp/profile.profraw %p/temp/profile-gen
+// RUN: llvm-profdata merge -o %p/temp/profile.profdata %p/temp/profile.profraw
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -fprofile-instr-use=%p/temp/profile.profdata \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang profile \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-hoist \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang verbose \
+// RUN: -S -emit-llvm %s -o %p/temp/profile-O2.ll > %p/temp/profile-O2.out \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/profile-O2.ll \
+// RUN: && FileCheck %s -check-prefix=OUT < %p/temp/profile-O2.out
+
+#include <cstddef>
+
+#include "stack_check.h"
+
+// По данным профиля проверка переносится из часто выполняемого блока в более холодный доминирующий блок,
+// если из него всегда выполняется защищённый вызов (вынос из циклов отключён аргументом no-hoist)
+
+size_t counter = 0;
+volatile bool rare = false;
+
+STACK_CHECK_SIZE(1000)
+[[gnu::noinline]] void guarded_step(size_t i) {
+    counter += i;
+    // Prevents the calls from being removed or merged
+    asm volatile("");
+}
+
+// The call is executed on each iteration, so its check is moved before the loop
+[[gnu::noinline]] void hot_loop(size_t iterations) {
+    size_t i = 0;
+    do {
+        guarded_step(i);
+    } while (++i < iterations);
+}
+
+// IR-LABEL: define {{.*}}void @_Z8hot_loopm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 1000)
+// IR-NOT: check_overflow
+// IR: call void @_Z12guarded_stepm(
+// IR: {{^}}}
+
+// The call is on a hot conditional path, which is not taken on some iterations, so its check is left in place
+[[gnu::noinline]] void hot_branch(size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        if (i % 8 != 0) {
+            guarded_step(i);
+        }
+    }
+}
+
+// IR-LABEL: define {{.*}}void @_Z10hot_branchm(
+// IR: urem
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 1000)
+// IR-NEXT: call void @_Z12guarded_stepm(
+// IR: {{^}}}
+
+[[gnu::noinline]] void checked_step(size_t i) {
+    if (i == static_cast<size_t>(-1)) {
+        throw i;
+    }
+}
+
+// The check is not moved before a call that may throw
+[[gnu::noinline]] void throwing_loop(size_t iterations) {
+    size_t i = 0;
+    do {
+        checked_step(i);
+        guarded_step(i);
+    } while (++i < iterations);
+}
+
+// IR-LABEL: define {{.*}}void @_Z13throwing_loopm(
+// IR: call void @_Z12checked_stepm(
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 1000)
+// IR-NEXT: call void @_Z12guarded_stepm(
+// IR: {{^}}}
+
+// The call is never executed in the profile, so its check is left in place
+[[gnu::noinline]] void rare_loop(size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        if (rare) {
+            guarded_step(i);
+        }
+    }
+}
+
+// IR-LABEL: define {{.*}}void @_Z9rare_loopm(
+// IR: load volatile {{.*}}@rare
+// IR: call void @_ZN5trust11stack_check14check_overflowEm(i64 1000)
+// IR-NEXT: call void @_Z12guarded_stepm(
+// IR: {{^}}}
+
+// OUT: Place checks in colder blocks by the profile data
+// OUT: verbose: Moved 1 of 1 stack checks to colder blocks in _Z8hot_loopm
+// OUT-NOT: colder blocks in _Z10hot_branchm
+// OUT-NOT: colder blocks in _Z13throwing_loopm
+// OUT-NOT: colder blocks in _Z9rare_loopm
+
+int main() {
+    hot_loop(1000);
+    hot_branch(1000);
+    throwing_loop(1000);
+    rare_loop(1000);
+    return counter == 0;
+}
@@ -0,0 +1,66 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O0 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang prologue \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -S -emit-llvm %s -o %p/temp/prologue-O0.ll \
+// RUN: && FileCheck %s -check-prefix=CALL < %p/temp/prologue-O0.ll
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang prologue \
+// RUN: -S -emit-llvm %s -o %p/temp/prologue-O2.ll \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/prologue-O2.ll
+
+#include "stack_check.h"
+
+// В режиме prologue проверка вставляется один раз в начало отмеченной функции, а не перед каждым её вызовом
+
+int counter = 0;
+
+STACK_CHECK_SIZE(100)
+[[gnu::noinline]] void prologue_function() {
+    char buffer[92];
+    buffer[0] = counter;
+    counter += buffer[0] + 1;
+}
+
+// CALL-LABEL: define {{.*}}void @_Z17prologue_functionv()
+// CALL: alloca
+// CALL-NOT: call
+// CALL: call void @_ZN5trust11stack_check14check_overflowEm(i64 100)
+
+// IR-LABEL: define {{.*}}void @_Z17prologue_functionv()
+// IR: call ptr @llvm.frameaddress.p0(i32 0)
+// IR: add i64 {{.*}}, 100
+// IR: br i1 {{.*}}, !prof
+// IR: call void @_ZN5trust11stack_check21check_overflow_failedEm(i64 100)
+
+STACK_CHECK_LIMIT
+[[gnu::noinline]] void prologue_limit() { counter += 2; }
+
+// CALL-LABEL: define {{.*}}void @_Z14prologue_limitv()
+// CALL-NOT: call
+// CALL: call void @_ZN5trust11stack_check11check_limitEv()
+
+// IR-LABEL: define {{.*}}void @_Z14prologue_limitv()
+// IR: call void @_ZN5trust11stack_check18check_limit_failedEv()
+
+// Calls, including the call through a pointer, are not instrumented
+void (*volatile pointer)() = prologue_limit;
+
+int main() {
+    prologue_function();
+    prologue_limit();
+    pointer();
+    return 0;
+}
+
+// CALL-LABEL: define {{.*}}i32 @main()
+// CALL-NOT: @_ZN5trust11stack_check
+// CALL: {{^}}}
+
+// IR-LABEL: define {{.*}}i32 @main()
+// IR-NOT: @_ZN5trust11stack_check
+// IR: {{^}}}
@@ -0,0 +1,97 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -O0 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang recursion \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang no-inline \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang verbose \
+// RUN: -S -emit-llvm %s -o %p/temp/recursion-O0.ll > %p/temp/recursion-O0.out \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/recursion-O0.ll \
+// RUN: && FileCheck %s -check-prefix=OUT < %p/temp/recursion-O0.out
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -O2 -fstack-size-section -DSTACK_SIZE_LIMIT=16384 \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang recursion \
+// RUN: %s -o %p/temp/recursion-O2 \
+// RUN: && %p/temp/recursion-O2 | FileCheck %s -check-prefix=EXEC
+
+#include <iostream>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+// Без атрибутов проверяются только вызовы, замыкающие циклы рекурсии (обратные рёбра графа вызовов)
+// Лимит проверки - это наибольший кадр из секции .stack_sizes (-fstack-size-section) плюс STACK_SIZE_LIMIT,
+// которого должно хватить на выброс исключения (при 1024 байтах раскрутке стека не хватает места)
+
+[[gnu::noinline]] size_t leaf(size_t value) { return value + 1; }
+
+// A self-recursive call is a back edge
+[[gnu::noinline]] size_t sum(size_t n) {
+    volatile char buffer[100];
+    buffer[0] = static_cast<char>(n);
+    size_t result = n ? sum(n - 1) : 0;
+    // Prevents the tail recursion elimination
+    asm volatile("" ::: "memory");
+    return result + leaf(buffer[0]);
+}
+
+// IR-LABEL: define {{.*}}i64 @_Z3summ(
+// IR-NOT: check_limit
+// IR: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call {{.*}}i64 @_Z3summ(
+// IR-NOT: check_limit
+// IR: {{^}}}
+
+// In mutual recursion, only the call that returns to the first function of the cycle is checked
+[[gnu::noinline]] bool is_odd(size_t n);
+
+[[gnu::noinline]] bool is_even(size_t n) {
+    volatile char buffer[100];
+    buffer[0] = static_cast<char>(n);
+    return n == 0 ? true : is_odd(n - 1) && buffer[0] != 1;
+}
+
+[[gnu::noinline]] bool is_odd(size_t n) { return n == 0 ? false : is_even(n - 1); }
+
+// IR-LABEL: define {{.*}}i1 @_Z7is_evenm(
+// IR-NOT: check_limit
+// IR: {{^}}}
+
+// IR-LABEL: define {{.*}}i1 @_Z6is_oddm(
+// IR: call void @_ZN5trust11stack_check11check_limitEv()
+// IR-NEXT: call {{.*}}i1 @_Z7is_evenm(
+
+// Calls outside the cycles are not checked
+size_t chain(size_t n) { return leaf(n) + sum(n) + is_even(n); }
+
+// IR-LABEL: define {{.*}}i64 @_Z5chainm(
+// IR-NOT: check_limit
+// IR: {{^}}}
+
+// OUT: verbose: Recursive cycle of 1 functions from _Z3summ: checks on 1 back edges
+// OUT: verbose: Recursive cycle of 2 functions from _Z7is_evenm: checks on 1 back edges
+
+int main() {
+    std::cout << "Short recursion: " << chain(10) << "\n";
+    // EXEC: Short recursion: {{[0-9]+}}
+
+    try {
+        sum(100'000'000);
+        std::cout << "Deep recursion: no overflow\n";
+    } catch (stack_overflow &) {
+        std::cout << "Deep recursion: stack overflow\n";
+    }
+    // EXEC: Deep recursion: stack overflow
+
+    try {
+        is_even(100'000'000);
+        std::cout << "Deep mutual recursion: no overflow\n";
+    } catch (stack_overflow &) {
+        std::cout << "Deep mutual recursion: stack overflow\n";
+    }
+    // EXEC: Deep mutual recursion: stack overflow
+
+    return 0;
+}
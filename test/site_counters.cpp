@@ -0,0 +1,46 @@
+// RUN: %clangxx -I%shlibdir -std=c++20 -gline-tables-only \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -Xclang -emit-llvm -O0 \
+// RUN: -Xclang -plugin-arg-stack_check -Xclang counters \
+// RUN: -c %s -o %p/temp/site_counters-O0.ll > %p/temp/site_counters-O0.out \
+// RUN: && FileCheck %s -check-prefix=IR < %p/temp/site_counters-O0.ll
+
+// RUN: %clangxx -I%shlibdir -std=c++20 -gline-tables-only \
+// RUN: -Xclang -load -Xclang %shlibdir/stack_check_clang.so \
+// RUN: -Xclang -add-plugin -Xclang stack_check \
+// RUN: -O2 -Xclang -plugin-arg-stack_check -Xclang counters \
+// RUN: %s -o %p/temp/site_counters > %p/temp/site_counters.out \
+// RUN: && env STACK_CHECK_SITES=%p/temp/site_counters.txt %p/temp/site_counters \
+// RUN: && FileCheck %s -check-prefix=DUMP < %p/temp/site_counters.txt
+
+#include "stack_check.h"
+
+STACK_CHECK_SIZE(100)
+[[clang::optnone]] void site_function() { char buffer[92]; }
+
+STACK_CHECK_LIMIT
+[[clang::optnone]] void site_limit() { char buffer[55]; }
+
+// IR: @[[NAME1:[.a-z_0-9]+]] = private unnamed_addr constant [{{[0-9]+}} x i8] c"_Z13site_functionv\00"
+// IR: @[[SITE1:__stack_check_site[.0-9]*]] = internal global { i64, i64, ptr, ptr, i64 } { i64 0, i64 -1, ptr @{{[.a-z_0-9]+}}, ptr @[[NAME1]], i64 33 }, section "stack_check_sites", align 8
+// IR: @[[NAME2:[.a-z_0-9]+]] = private unnamed_addr constant [{{[0-9]+}} x i8] c"_Z10site_limitv\00"
+// IR: @[[SITE2:__stack_check_site[.0-9]*]] = internal global { i64, i64, ptr, ptr, i64 } { i64 0, i64 -1, ptr @{{[.a-z_0-9]+}}, ptr @[[NAME2]], i64 38 }, section "stack_check_sites", align 8
+// IR: @llvm.compiler.used = {{.*}}@[[SITE1]]{{.*}}@[[SITE2]]
+
+int main() {
+    for (int i = 0; i < 10; i++) {
+        site_function();
+        // IR: call void @_ZN5trust11stack_check19check_overflow_siteEmPNS_16stack_check_siteE(i64 100, ptr @[[SITE1]])
+        // IR-NEXT: call void @_Z13site_functionv()
+    }
+
+    site_limit();
+    // IR: call void @_ZN5trust11stack_check16check_limit_siteEPNS_16stack_check_siteE(ptr @[[SITE2]])
+    // IR-NEXT: call void @_Z10site_limitv()
+
+    return 0;
+}
+
+// DUMP: {{.*}}site_counters.cpp:33: site_function(): calls 10, min free {{[1-9][0-9]*}}
+// DUMP: {{.*}}site_counters.cpp:38: site_limit(): calls 1, min free {{[1-9][0-9]*}}
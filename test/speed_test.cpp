@@ -8,8 +8,6 @@
 
 using namespace trust;
 
-const thread_local trust::stack_check trust::stack_check::info;
-
 bool isNumber(const std::string &str, long &num) {
     if (str.empty())
         return false;
@@ -29,7 +27,12 @@ size_t GetMaxDepth();
 void TrustRecursion(size_t depth);
 void UntrustRecursion(size_t depth);
 
+#ifdef SPEED_TEST_SHARED
+// The benchmark is built as a shared library to measure the cost of TLS access in checks from a DSO
+extern "C" int speed_test_main(int argc, char *argv[]) {
+#else
 int main(int argc, char *argv[]) {
+#endif
     // Если передано больше одного аргумента (помимо имени программы)
     if (argc > 2) {
         std::cerr << "Using: speed_test <depth>\nBy default, the maximum possible call depth is used." << std::endl;
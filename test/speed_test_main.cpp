@@ -0,0 +1,6 @@
+/*
+ * Entry point for the speed test built as a shared library (see SPEED_TEST_SHARED in speed_test.cpp)
+ */
+extern "C" int speed_test_main(int argc, char *argv[]);
+
+int main(int argc, char *argv[]) { return speed_test_main(argc, argv); }
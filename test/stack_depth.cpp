@@ -0,0 +1,88 @@
+// RUN: mkdir -p %p/temp/stack_depth
+// RUN: %clangxx -std=c++20 -O1 -fstack-size-section -fstack-usage %s -o %p/temp/stack_depth/stack-depth-O1
+// RUN: python3 %shlibdir/stack_depth.py %p/temp/stack_depth/stack-depth-O1 --su %p/temp/stack_depth \
+// RUN: | FileCheck %s -check-prefix=MAIN
+// RUN: python3 %shlibdir/stack_depth.py %p/temp/stack_depth/stack-depth-O1 -e level2 -e is_even \
+// RUN: | FileCheck %s -check-prefix=ENTRY
+// RUN: not python3 %shlibdir/stack_depth.py %p/temp/stack_depth/stack-depth-O1 -e unknown_entry 2>&1 \
+// RUN: | FileCheck %s -check-prefix=ERROR
+
+#include <alloca.h>
+#include <cstdio>
+
+// Глубина стека по цепочке вызовов: размеры кадров из секции .stack_sizes, граф вызовов из дизассемблера
+
+[[gnu::noinline]] int leaf_large(int x) {
+    volatile char buffer[4000];
+    buffer[x] = 1;
+    return buffer[0];
+}
+
+[[gnu::noinline]] int leaf_small(int x) {
+    volatile char buffer[16];
+    buffer[x] = 1;
+    return buffer[0];
+}
+
+[[gnu::noinline]] int level2(int x) {
+    volatile char buffer[100];
+    buffer[0] = x;
+    return leaf_large(x) + leaf_small(x) + buffer[0];
+}
+
+[[gnu::noinline]] int level1(int x) {
+    volatile char buffer[200];
+    buffer[0] = x;
+    return level2(x) + buffer[0];
+}
+
+// Mutual recursion has no static bound
+[[gnu::noinline]] bool is_odd(unsigned n);
+
+[[gnu::noinline]] bool is_even(unsigned n) {
+    volatile char buffer[50];
+    buffer[0] = n;
+    return n == 0 ? true : is_odd(n - 1) + buffer[0];
+}
+
+[[gnu::noinline]] bool is_odd(unsigned n) { return n == 0 ? false : is_even(n - 1); }
+
+// The size of a dynamic allocation is known only at runtime (the 'dynamic' qualifier in the .su file)
+[[gnu::noinline]] int dynamic(int n) {
+    char *buffer = static_cast<char *>(alloca(n));
+    buffer[0] = 1;
+    asm volatile("" ::"r"(buffer) : "memory");
+    return buffer[0];
+}
+
+// The target of a call through a pointer is unknown
+int (*volatile pointer)(int) = leaf_small;
+
+[[gnu::noinline]] int indirect(int x) { return pointer(x) + 1; }
+
+int main(int argc, char **) {
+    printf("%d\n", level1(argc) + is_even(argc) + dynamic(argc) + indirect(argc));
+    return 0;
+}
+
+// MAIN: Entry point: main
+// MAIN-NEXT: Worst case: {{4[0-9][0-9][0-9]}} bytes (unbounded)
+// MAIN-NEXT: Call chain: main -> level1(int) -> level2(int) -> leaf_large(int)
+// MAIN-NEXT: Without a static bound: {{.*}}dynamic(int)
+// MAIN: Recursive cycles:
+// MAIN-NEXT: is_odd(unsigned int) <-> is_even(unsigned int)
+// MAIN: Functions without a static bound, where a check is needed: 4
+// MAIN-DAG: is_odd(unsigned int): recursion
+// MAIN-DAG: is_even(unsigned int): recursion
+// MAIN-DAG: dynamic(int): dynamic stack
+// MAIN-DAG: indirect(int): indirect call
+// MAIN: Functions with a static bound: {{[0-9]+}} of {{[0-9]+}}
+
+// ENTRY: Entry point: level2(int)
+// ENTRY-NEXT: Worst case: {{4[0-9][0-9][0-9]}} bytes (bounded)
+// ENTRY-NEXT: Call chain: level2(int) -> leaf_large(int)
+// ENTRY-NEXT: Entry point: is_even(unsigned int)
+// ENTRY-NEXT: Worst case: {{[0-9]+}} bytes (unbounded)
+// ENTRY: Without a static bound: is_odd(unsigned int), is_even(unsigned int)
+
+// ERROR: Error: the entry point 'unknown_entry' is not found.
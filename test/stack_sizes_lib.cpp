@@ -0,0 +1,11 @@
+#include <cstddef>
+
+/*
+ * Shared library for checking the index of the `.stack_sizes` sections of objects loaded with `dlopen`
+ */
+
+extern "C" size_t stack_sizes_lib_func(size_t index) {
+    volatile char data[3'000'000];
+    data[index] = 1;
+    return data[index];
+}
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#include "stack_check.h"
+
+using namespace trust;
+
+/*
+ * Benchmark of the stack overflow path.
+ *
+ * The latency of throwing and catching the stack_overflow exception is compared with the previous
+ * implementation, which created a new message string for each exception (emulated by the old_stack_overflow class),
+ * and with the non-throwing check stack_check::try_check_overflow. The number of memory allocations
+ * via operator new is counted for each variant.
+ */
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *ptr = malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+// The exception of the previous implementation with a message string created for each throw
+struct old_stack_overflow : public std::runtime_error {
+    size_t size;
+    const stack_check *info;
+    old_stack_overflow(size_t size, const stack_check *stack) : std::runtime_error("Stack overflow"), size(size), info(stack) {}
+};
+
+[[gnu::noinline]] void old_throw(size_t size) {
+    if (stack_check::get_stack_address() < stack_check::info.bottom + size) {
+        throw old_stack_overflow(size, &stack_check::info);
+    }
+}
+
+template <typename Func> void measure(const char *name, size_t iterations, Func func) {
+    allocations = 0;
+    size_t handled = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        handled += func();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    std::cout << name << duration / iterations << " nanosecs, allocations " << allocations / (double)iterations
+              << " per overflow" << std::endl;
+    if (handled != iterations) {
+        std::cerr << "Error: " << iterations - handled << " overflows were not detected!" << std::endl;
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        std::cerr << "Using: throw_bench [iterations]\nBy default, 100000 iterations are used." << std::endl;
+        return 1;
+    }
+
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    if (!iterations) {
+        iterations = 1;
+    }
+
+    const size_t size = stack_check::get_stack_size() * 2;
+
+    measure("Throw with a new message string (before): ", iterations, [=]() {
+        try {
+            old_throw(size);
+        } catch (old_stack_overflow &) {
+            return 1;
+        }
+        return 0;
+    });
+
+    measure("Throw with the preallocated message:       ", iterations, [=]() {
+        try {
+            stack_check::check_overflow(size);
+        } catch (stack_overflow &) {
+            return 1;
+        }
+        return 0;
+    });
+
+    measure("Non-throwing try_check_overflow:           ", iterations,
+            [=]() { return stack_check::try_check_overflow(size) ? 0 : 1; });
+
+    return 0;
+}
@@ -4,8 +4,10 @@
 #include <gtest/gtest.h>
 
 #include <array>
+#include <dlfcn.h>
 #include <iostream>
 #include <stdexcept>
+#include <ucontext.h>
 #include <vector>
 
 #include "stack_check.h"
@@ -58,11 +60,11 @@ TEST(StackInfoTest2, GetFreeStackSpace) {
     char *current_frame = static_cast<char *>(__builtin_frame_address(0));
 
     EXPECT_TRUE(current_frame < stack_check::info.top);
-    EXPECT_TRUE(current_frame > stack_check::info.bottom);
+    EXPECT_TRUE(current_frame > reinterpret_cast<char *>(stack_check::info.bottom));
 
-    EXPECT_EQ(stack_size, static_cast<char *>(stack_check::info.top) - static_cast<char *>(stack_check::info.bottom));
-    stack_size = static_cast<char *>(stack_check::info.top) - static_cast<char *>(stack_check::info.bottom);
-    free_space = static_cast<char *>(current_frame) - static_cast<char *>(stack_check::info.bottom);
+    EXPECT_EQ(stack_size, static_cast<char *>(stack_check::info.top) - reinterpret_cast<char *>(stack_check::info.bottom));
+    stack_size = static_cast<char *>(stack_check::info.top) - reinterpret_cast<char *>(stack_check::info.bottom);
+    free_space = static_cast<char *>(current_frame) - reinterpret_cast<char *>(stack_check::info.bottom);
 
     EXPECT_GT(free_space, 0);
     EXPECT_LE(free_space, stack_size);
@@ -74,8 +76,8 @@ TEST(StackInfoTest2, GetFreeStackSpace) {
         EXPECT_EQ(stack.size, stack_size + 1);
         ASSERT_TRUE(stack.info);
         EXPECT_TRUE(static_cast<char *>(stack.info->frame) < static_cast<char *>(stack_check::info.top));
-        EXPECT_TRUE(static_cast<char *>(stack.info->frame) > static_cast<char *>(stack_check::info.bottom));
-        EXPECT_TRUE(static_cast<char *>(stack.info->frame) < static_cast<char *>(stack_check::info.bottom) + stack_size + 1);
+        EXPECT_TRUE(static_cast<char *>(stack.info->frame) > reinterpret_cast<char *>(stack_check::info.bottom));
+        EXPECT_TRUE(static_cast<char *>(stack.info->frame) < reinterpret_cast<char *>(stack_check::info.bottom) + stack_size + 1);
     }
 }
 
@@ -130,4 +132,209 @@ TEST(StackSizesSection, GetFreeStackSpace) {
     uint64_t stack_without_large = trust::stack_check::get_stack_limit(nullptr, &exclude);
     EXPECT_LE(stack_min, stack_without_large);
     EXPECT_GT(stack_max, stack_without_large);
-}
\ No newline at end of file
+}
+
+TEST(StackSizesSection, SortedIndex) {
+    trust::StackSizesSection section;
+
+    ASSERT_TRUE(section.begin() != section.end());
+
+    size_t count = 0;
+    uint64_t max_size = 0;
+    const trust::StackSizeEntry *prev = nullptr;
+    for (auto &entry : section) {
+        if (prev) {
+            EXPECT_LT(prev->addr, entry.addr);
+        }
+        EXPECT_EQ(&entry, section.find((void *)entry.addr));
+        max_size = std::max(max_size, entry.size);
+        prev = &entry;
+        count++;
+    }
+    EXPECT_EQ(count, section.getAddrList().size());
+    EXPECT_EQ(max_size, section.max_size);
+    EXPECT_LE(max_size, trust::stack_check::get_stack_limit());
+
+    EXPECT_EQ(nullptr, section.find(nullptr));
+    EXPECT_EQ(nullptr, section.find((void *)&func_dyn_stack));
+}
+
+TEST(StackSizesSection, ReadAndMappedELF) {
+    trust::StackSizesSection read_section{trust::ReadELF()};
+    trust::StackSizesSection mapped_section{trust::MappedELF()};
+
+    EXPECT_EQ(read_section.size, mapped_section.size);
+    EXPECT_EQ(read_section.max_size, mapped_section.max_size);
+    ASSERT_EQ(read_section.entries.size(), mapped_section.entries.size());
+    for (size_t i = 0; i < read_section.entries.size(); i++) {
+        EXPECT_EQ(read_section.entries[i].addr, mapped_section.entries[i].addr);
+        EXPECT_EQ(read_section.entries[i].size, mapped_section.entries[i].size);
+    }
+
+    EXPECT_THROW(trust::ReadELF("/proc/self/cmdline"), std::runtime_error);
+}
+
+#ifdef STACK_SIZES_LIB
+TEST(StackSizesIndex, DlopenLibrary) {
+    trust::StackSizesIndex &index = trust::StackSizesIndex::instance();
+    size_t objects = index.getObjectCount();
+    uint64_t limit = trust::stack_check::get_stack_limit();
+    EXPECT_GT(3'000'000, limit);
+
+    void *lib = dlopen(STACK_SIZES_LIB, RTLD_NOW | RTLD_LOCAL);
+    ASSERT_TRUE(lib) << dlerror();
+    void *func = dlsym(lib, "stack_sizes_lib_func");
+    ASSERT_TRUE(func);
+
+    // Only the new library is added to the index
+    EXPECT_EQ(objects + 1, index.getObjectCount());
+
+    bool found;
+    EXPECT_LE(3'000'000, index.getStackSize(func, &found));
+    EXPECT_TRUE(found);
+    EXPECT_LE(3'000'000, trust::stack_check::get_stack_limit());
+
+    std::vector<void *> include = {func};
+    EXPECT_LE(3'000'000, trust::stack_check::get_stack_limit(&include));
+
+    dlclose(lib);
+    EXPECT_EQ(objects, index.getObjectCount());
+    EXPECT_EQ(limit, trust::stack_check::get_stack_limit());
+}
+#endif
+
+// Стек волокна (fiber), на который переключается поток
+static ucontext_t fiber_main_ctx;
+static ucontext_t fiber_ctx;
+static stack_check fiber_saved;
+static size_t fiber_stack_size;
+
+static void fiber_func() {
+    EXPECT_EQ(fiber_stack_size, stack_check::get_stack_size());
+    EXPECT_GT(stack_check::get_free_stack_space(), 0);
+    EXPECT_LT(stack_check::get_free_stack_space(), fiber_stack_size);
+
+    EXPECT_NO_THROW(stack_check::check_overflow(1000));
+    EXPECT_THROW(stack_check::check_overflow(fiber_stack_size), stack_overflow);
+
+    // Возврат в основной контекст с восстановлением параметров стека потока
+    stack_check::switch_stack(fiber_saved);
+}
+
+TEST(StackInfoTest2, SwitchStack) {
+    size_t thread_stack_size = stack_check::get_stack_size();
+
+    fiber_stack_size = 256 * 1024;
+    std::vector<char> stack(fiber_stack_size);
+    const stack_check fiber(stack.data(), stack.size());
+
+    EXPECT_TRUE(fiber.is_initialized());
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(stack.data()), fiber.bottom);
+    EXPECT_EQ(stack.data() + stack.size(), fiber.top);
+    EXPECT_EQ(fiber.bottom + fiber.limit, fiber.bottom_limit);
+
+    ASSERT_EQ(0, getcontext(&fiber_ctx));
+    fiber_ctx.uc_stack.ss_sp = stack.data();
+    fiber_ctx.uc_stack.ss_size = stack.size();
+    fiber_ctx.uc_link = &fiber_main_ctx;
+    makecontext(&fiber_ctx, fiber_func, 0);
+
+    stack_check::switch_stack(fiber, &fiber_saved);
+    ASSERT_EQ(0, swapcontext(&fiber_main_ctx, &fiber_ctx));
+
+    EXPECT_EQ(thread_stack_size, stack_check::get_stack_size());
+    EXPECT_NO_THROW(stack_check::check_overflow(1000));
+}
+
+#ifdef STACK_CHECK_HIGH_WATER_MARK
+size_t max_used_recursion(size_t count) {
+    volatile char data[1000];
+    data[0] = static_cast<char>(count);
+    stack_check::check_overflow(sizeof(data));
+    if (count) {
+        return max_used_recursion(count - 1) + data[0];
+    }
+    return data[0];
+}
+
+void *max_used_in_thread(void *result) {
+    size_t *used = static_cast<size_t *>(result);
+    used[0] = stack_check::max_used();
+    max_used_recursion(10);
+    used[1] = stack_check::max_used();
+    return nullptr;
+}
+
+// Тест для проверки отслеживания максимального использования стека потока
+TEST(StackInfoTest2, MaxUsed) {
+    // Сброс значения, накопленного в предыдущих тестах
+    stack_check::reset_max_used();
+    stack_check::check_limit();
+    size_t used = stack_check::max_used();
+    EXPECT_GT(used, 0);
+    EXPECT_LT(used, stack_check::get_stack_size());
+
+    max_used_recursion(100);
+    EXPECT_GE(stack_check::max_used(), used + 99 * 1000);
+
+    // После сброса учитываются только новые проверки
+    stack_check::reset_max_used();
+    EXPECT_EQ(0, stack_check::max_used());
+    stack_check::check_limit();
+    EXPECT_GT(stack_check::max_used(), 0);
+    EXPECT_LE(stack_check::max_used(), used);
+
+    // Проверки без исключений тоже отмечают использование стека
+    stack_check::reset_max_used();
+    EXPECT_TRUE(stack_check::try_check_limit());
+    EXPECT_GT(stack_check::max_used(), 0);
+    stack_check::reset_max_used();
+    EXPECT_TRUE(stack_check::try_check_overflow(1000));
+    EXPECT_GT(stack_check::max_used(), 0);
+
+    size_t thread_used[2] = {1, 0};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, &max_used_in_thread, thread_used);
+    pthread_join(thread, 0);
+    EXPECT_EQ(0, thread_used[0]);
+    EXPECT_GE(thread_used[1], 10 * 1000);
+}
+#endif
+
+size_t segment_recursion(size_t count) {
+    volatile char data[1000];
+    data[0] = 1;
+    if (!count) {
+        return data[0];
+    }
+    return stack_segment::call(10'000, [count]() { return segment_recursion(count - 1); }) + data[0];
+}
+
+void segment_throw(size_t count) {
+    if (!count) {
+        throw std::runtime_error("Segment");
+    }
+    stack_segment::call(10'000, [count]() { segment_throw(count - 1); });
+}
+
+// Тест для проверки продолжения глубокой рекурсии на новых сегментах стека
+TEST(StackInfoTest2, StackSegment) {
+    size_t stack_size = stack_check::get_stack_size();
+    void *top = stack_check::info.top;
+
+    // Глубина рекурсии превышает размер стека потока
+    size_t depth = 3 * stack_size / 1000;
+    EXPECT_EQ(depth + 1, segment_recursion(depth));
+
+    // После возврата восстановлены параметры стека потока, а сегменты сохранены в пуле
+    EXPECT_EQ(top, stack_check::info.top);
+    EXPECT_EQ(stack_size, stack_check::get_stack_size());
+    EXPECT_GT(stack_segment::pooled(), 0);
+    EXPECT_LE(stack_segment::pooled(), stack_segment::pool_size);
+
+    // Исключение передаётся из сегмента в вызывающий код
+    EXPECT_THROW(segment_throw(depth), std::runtime_error);
+    EXPECT_EQ(top, stack_check::info.top);
+
+    EXPECT_EQ(2, stack_segment::call(10'000, []() { return 2; }));
+}
@@ -8,8 +8,6 @@
 
 using namespace trust;
 
-const thread_local trust::stack_check trust::stack_check::info;
-
 // Тест для проверки получения размера стека
 TEST(StackInfoTest, GetStackSize) {
     size_t stack_size = stack_check::get_stack_size();
@@ -52,11 +50,11 @@ TEST(StackInfoTest, GetFreeStackSpace) {
     char *current_frame = static_cast<char *>(__builtin_frame_address(0));
 
     EXPECT_TRUE(current_frame < stack_check::info.top);
-    EXPECT_TRUE(current_frame > stack_check::info.bottom);
+    EXPECT_TRUE(current_frame > reinterpret_cast<char *>(stack_check::info.bottom));
 
-    EXPECT_EQ(stack_size, static_cast<char *>(stack_check::info.top) - static_cast<char *>(stack_check::info.bottom));
-    stack_size = static_cast<char *>(stack_check::info.top) - static_cast<char *>(stack_check::info.bottom);
-    free_space = static_cast<char *>(current_frame) - static_cast<char *>(stack_check::info.bottom);
+    EXPECT_EQ(stack_size, static_cast<char *>(stack_check::info.top) - reinterpret_cast<char *>(stack_check::info.bottom));
+    stack_size = static_cast<char *>(stack_check::info.top) - reinterpret_cast<char *>(stack_check::info.bottom);
+    free_space = static_cast<char *>(current_frame) - reinterpret_cast<char *>(stack_check::info.bottom);
 
     EXPECT_GT(free_space, 0);
     EXPECT_LE(free_space, stack_size);
@@ -68,8 +66,8 @@ TEST(StackInfoTest, GetFreeStackSpace) {
         EXPECT_EQ(stack.size, stack_size + 1);
         ASSERT_TRUE(stack.info);
         EXPECT_TRUE(static_cast<char *>(stack.info->frame) < static_cast<char *>(stack_check::info.top));
-        EXPECT_TRUE(static_cast<char *>(stack.info->frame) > static_cast<char *>(stack_check::info.bottom));
-        EXPECT_TRUE(static_cast<char *>(stack.info->frame) < static_cast<char *>(stack_check::info.bottom) + stack_size + 1);
+        EXPECT_TRUE(static_cast<char *>(stack.info->frame) > reinterpret_cast<char *>(stack_check::info.bottom));
+        EXPECT_TRUE(static_cast<char *>(stack.info->frame) < reinterpret_cast<char *>(stack_check::info.bottom) + stack_size + 1);
     }
 }
 
@@ -150,6 +148,54 @@ TEST(StackInfoTest, StackInfoInThread) {
     EXPECT_TRUE(info_1000000.FreeSpace < info_1000000.StackSize);
 }
 
+struct SharedStackSizesTest {
+    const StackSizesIndex *index;
+    size_t limit;
+};
+
+void *get_stack_sizes_instance(void *result) {
+    stack_check::check_limit();
+    static_cast<SharedStackSizesTest *>(result)->index = &StackSizesIndex::instance();
+    static_cast<SharedStackSizesTest *>(result)->limit = stack_check::info.limit;
+    return nullptr;
+}
+
+// Тест для проверки однократного разбора секции .stack_sizes для всех потоков
+TEST(StackInfoTest, SharedStackSizes) {
+    stack_check::check_limit();
+
+    StackSizesIndex *index = &StackSizesIndex::instance();
+    EXPECT_EQ(index, &StackSizesIndex::instance());
+
+    SharedStackSizesTest result = {nullptr, 0};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, &get_stack_sizes_instance, &result);
+    pthread_join(thread, 0);
+
+    EXPECT_EQ(index, result.index);
+    EXPECT_EQ(stack_check::info.limit, result.limit);
+    EXPECT_EQ(stack_check::info.limit, index->getMaxSize() + stack_check::limit_for_error);
+}
+
+void *lazy_thread_init(void *result) {
+    bool *initialized = static_cast<bool *>(result);
+    initialized[0] = stack_check::info.is_initialized();
+    stack_check::check_overflow(stack_check::limit_for_error);
+    initialized[1] = stack_check::info.is_initialized();
+    return nullptr;
+}
+
+// Тест для проверки отложенной инициализации параметров стека потока при первой проверке
+TEST(StackInfoTest, LazyThreadInit) {
+    bool initialized[2] = {true, false};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, &lazy_thread_init, initialized);
+    pthread_join(thread, 0);
+
+    EXPECT_FALSE(initialized[0]);
+    EXPECT_TRUE(initialized[1]);
+}
+
 size_t recursion(StackInfoTest &info, size_t count) {
     size_t size = 0;
     std::array<size_t, 1000> data;
@@ -161,12 +207,12 @@ size_t recursion(StackInfoTest &info, size_t count) {
     if (count) {
         stack_check::check_overflow(8 * 1000);
 
-        info.FreeSpace = static_cast<char *>(__builtin_frame_address(0)) - static_cast<char *>(stack_check::info.bottom);
+        info.FreeSpace = static_cast<char *>(__builtin_frame_address(0)) - reinterpret_cast<char *>(stack_check::info.bottom);
 
         return size + recursion(info, count - 1);
     }
-    info.StackSize = static_cast<char *>(stack_check::info.top) - static_cast<char *>(stack_check::info.bottom);
-    info.FreeSpace = static_cast<char *>(__builtin_frame_address(0)) - static_cast<char *>(stack_check::info.bottom);
+    info.StackSize = static_cast<char *>(stack_check::info.top) - reinterpret_cast<char *>(stack_check::info.bottom);
+    info.FreeSpace = static_cast<char *>(__builtin_frame_address(0)) - reinterpret_cast<char *>(stack_check::info.bottom);
     return 0;
 }
 
@@ -196,6 +242,166 @@ TEST(StackInfoTest, StackOverflow) {
     //           << " bytes of free stack space left.\n";
 }
 
+void *try_check_in_thread(void *result) {
+    bool *checks = static_cast<bool *>(result);
+    checks[0] = stack_check::info.is_initialized();
+    checks[1] = stack_check::try_check_limit();
+    checks[2] = stack_check::try_check_overflow(1'000'000'000);
+    return nullptr;
+}
+
+// Тест для проверки функций без создания исключений
+TEST(StackInfoTest, TryCheck) {
+    stack_check::info.frame = nullptr;
+    EXPECT_TRUE(stack_check::try_check_overflow(1000));
+    EXPECT_TRUE(stack_check::try_check_limit());
+    EXPECT_FALSE(stack_check::try_check_overflow(1'000'000'000));
+    EXPECT_EQ(nullptr, stack_check::info.frame);
+
+    // Первая проверка в потоке выполняет инициализацию
+    bool checks[3] = {true, false, true};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, &try_check_in_thread, checks);
+    pthread_join(thread, 0);
+    EXPECT_FALSE(checks[0]);
+    EXPECT_TRUE(checks[1]);
+    EXPECT_FALSE(checks[2]);
+
+    // Сообщение исключения создано заранее и общее для всех исключений
+    try {
+        stack_check::check_overflow(1'000'000'000);
+        FAIL();
+    } catch (stack_overflow &stack) {
+        EXPECT_STREQ("Stack overflow", stack.what());
+        EXPECT_EQ(stack_overflow::message().what(), stack.what());
+    }
+}
+
+[[gnu::noinline]] size_t auto_frame_function(size_t value) {
+    volatile char data[500];
+    data[0] = static_cast<char>(value);
+    return data[0];
+}
+
+static int not_a_function = 0;
+
+// Тест для проверки размера кадра, определяемого по секции .stack_sizes (STACK_CHECK_SIZE(0))
+TEST(StackInfoTest, FrameSize) {
+    stack_check_frame frame = {reinterpret_cast<const void *>(&auto_frame_function), stack_check_frame::unresolved};
+
+    // Размер кадра определяется при первой проверке
+    stack_check::check_overflow_frame(&frame);
+    EXPECT_NE(stack_check_frame::unresolved, frame.size);
+    EXPECT_EQ(StackSizesIndex::instance().getStackSize(reinterpret_cast<void *>(&auto_frame_function)), frame.size);
+
+    // Последующие проверки используют найденный размер
+    stack_check::check_overflow_frame(&frame);
+    frame.size = 1'000'000'000;
+    EXPECT_THROW(stack_check::check_overflow_frame(&frame), stack_overflow);
+
+    stack_check_frame unknown = {&not_a_function, stack_check_frame::unresolved};
+    EXPECT_THROW(stack_check::check_overflow_frame(&unknown), std::runtime_error);
+    EXPECT_EQ(stack_check_frame::unresolved, unknown.size);
+}
+
+// Рекурсия без проверок, переполнение стека определяется по странице защиты
+size_t unchecked_recursion(size_t &depth) {
+    volatile char data[1000];
+    data[0] = static_cast<char>(depth++);
+    size_t result = unchecked_recursion(depth) + data[0];
+    // Запрет преобразования рекурсии в цикл
+    asm volatile("" ::: "memory");
+    return result;
+}
+
+void *guard_page_in_thread(void *result) {
+    size_t depth = 0;
+    try {
+        stack_guard::call([&]() { unchecked_recursion(depth); });
+    } catch (stack_overflow &) {
+        *static_cast<size_t *>(result) = depth;
+    }
+    return nullptr;
+}
+
+// Тест для проверки режима без проверок при вызове (страница защиты и альтернативный стек сигналов)
+TEST(StackInfoTest, GuardPage) {
+    size_t depth = 0;
+    EXPECT_THROW(stack_guard::call([&]() { unchecked_recursion(depth); }), stack_overflow);
+    EXPECT_GT(depth, 1000);
+    EXPECT_EQ(nullptr, stack_guard::jump);
+
+    // После перехвата переполнения продолжают работать явные проверки и повторный вызов
+    EXPECT_NO_THROW(stack_check::check_overflow(1000));
+    EXPECT_THROW(stack_check::check_overflow(1'000'000'000), stack_overflow);
+    depth = 0;
+    EXPECT_THROW(stack_guard::call([&]() { unchecked_recursion(depth); }), stack_overflow);
+
+    bool called = false;
+    EXPECT_NO_THROW(stack_guard::call([&]() { called = true; }));
+    EXPECT_TRUE(called);
+
+    pthread_attr_t attribute;
+    pthread_attr_init(&attribute);
+    pthread_attr_setstacksize(&attribute, 1'000'000);
+
+    size_t thread_depth = 0;
+    pthread_t thread;
+    pthread_create(&thread, &attribute, &guard_page_in_thread, &thread_depth);
+    pthread_join(thread, 0);
+    EXPECT_GT(thread_depth, 100);
+    EXPECT_LT(thread_depth, 1000);
+}
+
+// Ошибки доступа вне области защиты ниже стека не считаются переполнением
+TEST(StackInfoTest, GuardPageFault) {
+    EXPECT_NO_THROW(stack_guard::call([]() {}));
+    ASSERT_GE(stack_guard::guard_size, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+
+    const uintptr_t bottom = stack_check::info.bottom;
+    EXPECT_TRUE(stack_guard::is_stack_fault(reinterpret_cast<void *>(bottom - 1)));
+    EXPECT_TRUE(stack_guard::is_stack_fault(reinterpret_cast<void *>(bottom - stack_guard::guard_size)));
+    EXPECT_FALSE(stack_guard::is_stack_fault(reinterpret_cast<void *>(bottom - stack_guard::guard_size - 1)));
+    EXPECT_FALSE(stack_guard::is_stack_fault(reinterpret_cast<void *>(bottom - 1024 * 1024)));
+    EXPECT_FALSE(stack_guard::is_stack_fault(stack_check::info.top));
+}
+
+void *alt_stack_in_thread(void *result) {
+    std::vector<char> memory(256 * 1024);
+    stack_t own = {};
+    own.ss_sp = memory.data();
+    own.ss_size = memory.size();
+    sigaltstack(&own, nullptr);
+
+    size_t depth = 0;
+    try {
+        stack_guard::call([&]() { unchecked_recursion(depth); });
+    } catch (stack_overflow &) {
+    }
+
+    stack_t current = {};
+    sigaltstack(nullptr, &current);
+    *static_cast<bool *>(result) = depth > 100 && current.ss_sp == memory.data();
+
+    own.ss_flags = SS_DISABLE;
+    sigaltstack(&own, nullptr);
+    return nullptr;
+}
+
+// Альтернативный стек сигналов, установленный приложением, не заменяется
+TEST(StackInfoTest, GuardPageAltStack) {
+    pthread_attr_t attribute;
+    pthread_attr_init(&attribute);
+    pthread_attr_setstacksize(&attribute, 1'000'000);
+
+    bool kept = false;
+    pthread_t thread;
+    pthread_create(&thread, &attribute, &alt_stack_in_thread, &kept);
+    pthread_join(thread, 0);
+    pthread_attr_destroy(&attribute);
+    EXPECT_TRUE(kept);
+}
+
 // Основная функция для запуска тестов
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);